@@ -0,0 +1,101 @@
+/* LTFT - long term fuel trim for SECU-3, fixed point helpers
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file fixmath.h
+ * Saturating fixed point primitives used by lambda correction and LTFT.
+ * Values are kept in binary scales (x64, x512, x2048), scale of a product is
+ * removed by the shift argument. Depends only on <stdint.h>, tested on the
+ * host by host/test_fixmath.c.
+ */
+
+#ifndef _FIXMATH_H_
+#define _FIXMATH_H_
+
+#include <stdint.h>
+
+/** Saturates 32-bit value to the range of int16_t
+ * \param v Value
+ * \return v limited to -32768...32767
+ */
+static inline int16_t fix_sat16(int32_t v) {
+	if (v > INT16_MAX) {return INT16_MAX;}
+	if (v < INT16_MIN) {return INT16_MIN;}
+	return (int16_t)v;
+}
+
+/** Saturates 32-bit value to the range of uint16_t
+ * \param v Value
+ * \return v limited to 0...65535
+ */
+static inline uint16_t fix_usat16(uint32_t v) {
+	return (v > UINT16_MAX) ? UINT16_MAX : (uint16_t)v;
+}
+
+/** Limits value to the specified range
+ * \param v Value
+ * \param lo Lower limit
+ * \param hi Upper limit
+ * \return v limited to lo...hi
+ */
+static inline int16_t fix_clamp16(int16_t v, int16_t lo, int16_t hi) {
+	if (v > hi) {return hi;}
+	if (v < lo) {return lo;}
+	return v;
+}
+
+/** Saturating addition
+ * \return a + b limited to the range of int16_t
+ */
+static inline int16_t fix_add_sat16(int16_t a, int16_t b) {
+	return fix_sat16((int32_t)a + b);
+}
+
+/** Absolute value without branches
+ * \param v Value, -32768 is returned as 32768
+ * \return |v|
+ */
+static inline uint16_t fix_abs16(int16_t v) {
+	int16_t m = v >> 15;
+	return (uint16_t)((v ^ m) - m);
+}
+
+/** Signed multiplication with removal of scale: (a * b) >> shift.
+ * Result is rounded toward zero, as if the shift was applied to |a * b| and
+ * the sign was restored afterwards. Product of int16_t and uint16_t always
+ * fits in 32 bits, so no overflow is possible.
+ * \param a Signed value
+ * \param b Unsigned value (e.g. weight or coefficient)
+ * \param shift Scale of the product to remove (0...15)
+ * \return scaled product, use fix_sat16() to narrow it
+ */
+static inline int32_t fix_mul_shift(int16_t a, uint16_t b, uint8_t shift) {
+	int32_t p = (int32_t)a * b;
+	//bias negative products by (2^shift - 1) to round toward zero
+	p += (p >> 31) & (((int32_t)1 << shift) - 1);
+	return p >> shift;
+}
+
+/** Unsigned multiplication with removal of scale: (a * b) >> shift
+ * \param a Unsigned value
+ * \param b Unsigned value
+ * \param shift Scale of the product to remove (0...16)
+ * \return scaled product limited to the range of uint16_t
+ */
+static inline uint16_t fix_umul_shift(uint16_t a, uint16_t b, uint8_t shift) {
+	return fix_usat16(((uint32_t)a * b) >> shift);
+}
+
+#endif //_FIXMATH_H_
@@ -0,0 +1,484 @@
+// Замер времени функций LTFT и такта лямбда коррекции на хосте.
+//
+// Рабочие точки берутся из смеси режимов: ХХ, частичные нагрузки, полная
+// нагрузка. Для каждой функции выводится время на вызов и, если ядро
+// дает доступ к счетчикам (perf_event_open), число инструкций и ветвлений.
+// Абсолютные значения на ПК не равны AVR, но отношение между функциями
+// и изменения от правки к правке переносятся.
+//
+// Для сравнения замеряются прежние варианты с делением (веса точек,
+// деление шага обучения) и выводится отличие результатов ядра обратных
+// значений от деления. Число чтений сетки при поиске ячеек считается для
+// kosh_cell_locate() и прежнего линейного поиска на случайных точках и на
+// плавной траектории. Зависимость от размера сетки - bench_grid.sh.
+//
+// bench [-n вызовов]
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "host.h"
+#include "lambda.h"
+#include "ltft.h"
+#include "magnitude.h"
+
+// Число рабочих точек, степень двойки
+#define BENCH_POINTS 4096
+#define BENCH_MASK (BENCH_POINTS - 1)
+
+typedef struct {
+	uint16_t RPM;
+	uint16_t MAP;					// x64
+	uint16_t AFR;					// x128
+	int16_t Lambda;					// x512
+} BenchPoint_t;
+
+// Состояние алгоритма после поиска ячеек и расчета весов для точки
+typedef struct {
+	uint16_t RPM;
+	uint16_t MAP;
+	uint8_t x1, x2, y1, y2;
+	uint16_t CellsProp[4];
+	KoshStep_t Step;
+	uint16_t CalcVE2;
+} BenchCell_t;
+
+typedef struct {
+	const char *Name;
+	void (*Run)(uint32_t i);
+} BenchCase_t;
+
+// Операнды деления Num * 2^Scale / Den шага обучения
+typedef struct {
+	int16_t Num;
+	uint16_t Den;
+	uint8_t Scale;
+} BenchDiv_t;
+
+static BenchPoint_t Points[BENCH_POINTS];
+static BenchCell_t Cells[BENCH_POINTS];
+static BenchDiv_t Divs[BENCH_POINTS];
+static volatile int32_t Sink;
+static Kosh_t Kosh;
+static lambda_state_t Ego;
+
+static uint32_t Seed = 12345;
+
+// Равномерное случайное число Lo...Hi, одинаковое от запуска к запуску
+static uint16_t bench_rand(uint16_t Lo, uint16_t Hi) {
+	Seed = Seed * 1103515245 + 12345;
+	return Lo + (Seed >> 8) % (Hi - Lo + 1);
+}
+
+// Точки: 30% ХХ, 55% частичные нагрузки, 15% полная нагрузка
+static void bench_points(void) {
+	for (int i = 0; i < BENCH_POINTS; i++) {
+		BenchPoint_t *p = &Points[i];
+		uint16_t Mode = bench_rand(0, 99);
+		if (Mode < 30) {
+			p->RPM = bench_rand(750, 900);
+			p->MAP = bench_rand(28 * 64, 36 * 64);
+		}
+		else if (Mode < 85) {
+			p->RPM = bench_rand(1300, 3800);
+			p->MAP = bench_rand(35 * 64, 70 * 64);
+		}
+		else {
+			p->RPM = bench_rand(2000, 6200);
+			p->MAP = bench_rand(80 * 64, 99 * 64);
+		}
+		p->AFR = bench_rand(AFRVAL_MAG(13.5), AFRVAL_MAG(15.9));
+		// Коррекция всегда выше порога обучения, знак случайный
+		p->Lambda = bench_rand(LAMBDA_LEARN_THRD, 30);
+		if (bench_rand(0, 1)) {p->Lambda = -p->Lambda;}
+	}
+}
+
+// Промежуточные состояния для замера отдельных этапов шага обучения
+static void bench_cells(void) {
+	for (int i = 0; i < BENCH_POINTS; i++) {
+		BenchCell_t *c = &Cells[i];
+		Kosh.RPM = Points[i].RPM;
+		Kosh.MAP = Points[i].MAP;
+		kosh_find_cells(&Kosh);
+		kosh_ve_fetch(&Kosh);
+		kosh_points_weight(&Kosh);
+
+		c->RPM = Kosh.RPM;
+		c->MAP = Kosh.MAP;
+		c->x1 = Kosh.x1;
+		c->x2 = Kosh.x2;
+		c->y1 = Kosh.y1;
+		c->y2 = Kosh.y2;
+		memcpy(c->CellsProp, Kosh.CellsProp, sizeof(c->CellsProp));
+		for (int j = 0; j < 4; j++) {
+			c->Step.LTFTVE[j] = Kosh.StartVE[j];
+		}
+		c->Step.CalcVE = kosh_cells_dot(Kosh.CellsProp, c->Step.LTFTVE);
+		c->Step.TargetVe = ((uint32_t) c->Step.CalcVE * (512 + Points[i].Lambda)) >> 9;
+		c->CalcVE2 = c->Step.CalcVE + (c->Step.TargetVe - c->Step.CalcVE) / 3;
+	}
+}
+
+// Операнды: LTFTAdd = Delta * 512 / StartVE (VE 0.3...1.5) и
+// Cf = (Target - CalcVE2) * 1024 / SummDelta (SummDelta от 1)
+static void bench_divs(void) {
+	for (int i = 0; i < BENCH_POINTS; i++) {
+		BenchDiv_t *v = &Divs[i];
+		v->Num = bench_rand(0, 1600);
+		if (bench_rand(0, 1)) {v->Num = -v->Num;}
+		if (i & 1) {
+			v->Den = bench_rand(614, 3072);
+			v->Scale = 9;
+		}
+		else {
+			v->Den = bench_rand(1, 1024);
+			v->Scale = 10;
+		}
+	}
+}
+
+// Деление с ограничением диапазоном int16_t
+static int16_t bench_sdiv(int16_t Num, uint16_t Den, uint8_t Scale) {
+	if (!Den) {return 0;}
+	int32_t Q = ((int32_t) Num * (1 << Scale)) / Den;
+	return Q > INT16_MAX ? INT16_MAX : (Q < INT16_MIN ? INT16_MIN : Q);
+}
+
+// Веса точек делением на размер ячейки, как до замены делений
+static void bench_points_weight_div(Kosh_t *K, uint16_t *Prop) {
+	uint16_t x1 = K->RPMAxis[K->x1];
+	uint16_t x2 = K->RPMAxis[K->x2];
+	uint16_t y1 = K->LoadAxis[K->y1];
+	uint16_t y2 = K->LoadAxis[K->y2];
+
+	uint16_t CFx1 = (uint32_t) (x2 - K->RPM) * 2048 / (x2 - x1);
+	uint16_t CFx2 = (uint32_t) (K->RPM - x1) * 2048 / (x2 - x1);
+	uint16_t CFy1 = (uint32_t) (y2 - K->MAP) * 2048 / (y2 - y1);
+	uint16_t CFy2 = (uint32_t) (K->MAP - y1) * 2048 / (y2 - y1);
+
+	Prop[0] = ((uint32_t) CFx1 * CFy1) >> 11;
+	Prop[1] = ((uint32_t) CFx1 * CFy2) >> 11;
+	Prop[2] = ((uint32_t) CFx2 * CFy2) >> 11;
+	Prop[3] = ((uint32_t) CFx2 * CFy1) >> 11;
+}
+
+// Буфер тактов заполнен точками подряд, чтение сдвигается по буферу
+static void bench_buffer(void) {
+	for (int i = 0; i < KOSH_CBS * 4; i++) {
+		kosh_circular_buffer_push(&Kosh, Points[i & BENCH_MASK].RPM, Points[i & BENCH_MASK].MAP);
+	}
+}
+
+static void run_find_cells(uint32_t i) {
+	Kosh.RPM = Points[i & BENCH_MASK].RPM;
+	Kosh.MAP = Points[i & BENCH_MASK].MAP;
+	kosh_find_cells(&Kosh);
+}
+
+static void run_points_weight(uint32_t i) {
+	const BenchCell_t *c = &Cells[i & BENCH_MASK];
+	Kosh.RPM = c->RPM;
+	Kosh.MAP = c->MAP;
+	Kosh.x1 = c->x1;
+	Kosh.x2 = c->x2;
+	Kosh.y1 = c->y1;
+	Kosh.y2 = c->y2;
+	kosh_points_weight(&Kosh);
+}
+
+static void run_points_weight_div(uint32_t i) {
+	const BenchCell_t *c = &Cells[i & BENCH_MASK];
+	Kosh.RPM = c->RPM;
+	Kosh.MAP = c->MAP;
+	Kosh.x1 = c->x1;
+	Kosh.x2 = c->x2;
+	Kosh.y1 = c->y1;
+	Kosh.y2 = c->y2;
+	bench_points_weight_div(&Kosh, Kosh.CellsProp);
+}
+
+static void run_sdiv(uint32_t i) {
+	const BenchDiv_t *v = &Divs[i & BENCH_MASK];
+	Sink = kosh_sdiv(v->Num, v->Den, v->Scale);
+}
+
+static void run_sdiv_div(uint32_t i) {
+	const BenchDiv_t *v = &Divs[i & BENCH_MASK];
+	Sink = bench_sdiv(v->Num, v->Den, v->Scale);
+}
+
+static void run_add_ve_calculate(uint32_t i) {
+	BenchCell_t *c = &Cells[i & BENCH_MASK];
+	memcpy(Kosh.CellsProp, c->CellsProp, sizeof(c->CellsProp));
+	kosh_add_ve_calculate(&Kosh, &c->Step, Points[i & BENCH_MASK].Lambda, c->CalcVE2);
+}
+
+static void run_rpm_map_calc(uint32_t i) {
+	Kosh.BufferIndex = i % KOSH_CBS;
+	kosh_rpm_map_calc(&Kosh);
+}
+
+static void run_buffer_update(uint32_t i) {
+	d.sens.inst_frq = Points[i & BENCH_MASK].RPM;
+	d.sens.inst_map = Points[i & BENCH_MASK].MAP;
+	kosh_circular_buffer_update(&Kosh);
+}
+
+static void run_ltft_control(uint32_t i) {
+	Kosh.BufferIndex = i % KOSH_CBS;
+	d.corr.lambda[0] = Points[i & BENCH_MASK].Lambda;
+	kosh_ltft_control(&Kosh, 0);
+}
+
+static void run_lambda_stroke(uint32_t i) {
+	d.sens.inst_frq = Points[i & BENCH_MASK].RPM;
+	d.sens.afr[0] = Points[i & BENCH_MASK].AFR;
+	lambda_inst_stroke_event_notification(&Ego);
+}
+
+static const BenchCase_t Cases[] = {
+	{"kosh_find_cells", run_find_cells},
+	{"kosh_points_weight", run_points_weight},
+	{"kosh_points_weight (division)", run_points_weight_div},
+	{"kosh_sdiv", run_sdiv},
+	{"kosh_sdiv (division)", run_sdiv_div},
+	{"kosh_add_ve_calculate", run_add_ve_calculate},
+	{"kosh_rpm_map_calc", run_rpm_map_calc},
+	{"kosh_circular_buffer_update", run_buffer_update},
+	{"kosh_ltft_control", run_ltft_control},
+	{"lambda_stroke_event_notification", run_lambda_stroke},
+};
+
+// Отличие ядра обратных значений от деления: веса точек и деления шага
+static void bench_accuracy(void) {
+	int MaxProp = 0;
+	double SumProp = 0;
+	int MinSum = 2048, MaxSum = 2048;
+	for (int i = 0; i < BENCH_POINTS; i++) {
+		uint16_t Prop[4];
+		run_points_weight(i);
+		bench_points_weight_div(&Kosh, Prop);
+		int Sum = 0;
+		for (int j = 0; j < 4; j++) {
+			int Diff = abs((int) Kosh.CellsProp[j] - Prop[j]);
+			if (Diff > MaxProp) {MaxProp = Diff;}
+			SumProp += Diff;
+			Sum += Prop[j];
+		}
+		if (Sum < MinSum) {MinSum = Sum;}
+		if (Sum > MaxSum) {MaxSum = Sum;}
+	}
+
+	int MaxDiv[2] = {0, 0};
+	double SumDiv[2] = {0, 0};
+	for (int i = 0; i < BENCH_POINTS; i++) {
+		const BenchDiv_t *v = &Divs[i];
+		int Diff = abs(kosh_sdiv(v->Num, v->Den, v->Scale) - bench_sdiv(v->Num, v->Den, v->Scale));
+		if (Diff > MaxDiv[i & 1]) {MaxDiv[i & 1] = Diff;}
+		SumDiv[i & 1] += Diff;
+	}
+
+	printf("# reciprocal kernel vs division, %d points:\n", BENCH_POINTS);
+	printf("#   CellsProp x2048: max diff %d, mean %.3f; sum of weights 2048 (division %d...%d)\n",
+		MaxProp, SumProp / (BENCH_POINTS * 4), MinSum, MaxSum);
+	printf("#   LTFTAdd x512 (Delta * 512 / StartVE): max diff %d, mean %.3f\n", MaxDiv[1], SumDiv[1] / (BENCH_POINTS / 2));
+	printf("#   Cf x1024 (Diff * 1024 / SummDelta): max diff %d, mean %.3f\n", MaxDiv[0], SumDiv[0] / (BENCH_POINTS / 2));
+}
+
+// Поиск ячейки так же, как kosh_cell_locate(), с подсчетом чтений сетки
+static uint8_t bench_locate(const uint16_t *Axis, uint8_t Top, uint16_t Value, uint8_t Last, int *Probes) {
+	uint8_t Lo = 1;
+	uint8_t Hi = Top;
+	int n = 0;
+
+	if (Last >= 1 && Last <= Top) {
+		n++;
+		if (Value <= Axis[Last]) {
+			n++;
+			if (Value > Axis[Last - 1]) {*Probes += n; return Last;}
+			if (Last >= 2) {
+				n++;
+				if (Value > Axis[Last - 2]) {*Probes += n; return Last - 1;}
+				Hi = Last - 2;
+			}
+		}
+		else if (Last < Top) {
+			n++;
+			if (Value <= Axis[Last + 1]) {*Probes += n; return Last + 1;}
+			if (Last + 2 <= Top) {Lo = Last + 2;}
+		}
+	}
+
+	while (Lo < Hi) {
+		uint8_t Mid = (Lo + Hi) >> 1;
+		n++;
+		if (Value <= Axis[Mid]) {Hi = Mid;}
+		else {Lo = Mid + 1;}
+	}
+	*Probes += n;
+	return Lo;
+}
+
+// Прежний линейный поиск от индекса 1
+static uint8_t bench_linear(const uint16_t *Axis, uint8_t Top, uint16_t Value, int *Probes) {
+	uint8_t i = 1;
+	while (i < Top && Value > Axis[i]) {i++;}
+	*Probes += i;
+	return i;
+}
+
+// Чтения сетки на вызов kosh_find_cells() (обе оси) для последовательности точек
+static void bench_probes_run(const char *Title, const BenchPoint_t *Seq) {
+	uint8_t LastX = 0, LastY = 0;
+	int Sum[2] = {0, 0};
+	int Max[2] = {0, 0};
+	int Mismatch = 0;
+	for (int i = 0; i < BENCH_POINTS; i++) {
+		uint16_t RPM = Seq[i].RPM;
+		uint16_t MAP = Seq[i].MAP;
+		if (RPM <= Kosh.RPMAxis[0]) {RPM = Kosh.RPMAxis[0] + 1;}
+		if (RPM >= Kosh.RPMAxis[KOSH_GRID_RPM - 1]) {RPM = Kosh.RPMAxis[KOSH_GRID_RPM - 1] - 1;}
+		if (MAP <= Kosh.LoadAxis[0]) {MAP = Kosh.LoadAxis[0] + 1;}
+		if (MAP >= Kosh.LoadAxis[KOSH_GRID_LOAD - 1]) {MAP = Kosh.LoadAxis[KOSH_GRID_LOAD - 1] - 1;}
+
+		int Probes[2] = {0, 0};
+		uint8_t x = bench_locate(Kosh.RPMAxis, KOSH_GRID_RPM - 1, RPM, LastX, &Probes[0]);
+		uint8_t y = bench_locate(Kosh.LoadAxis, KOSH_GRID_LOAD - 1, MAP, LastY, &Probes[0]);
+		if (x != kosh_cell_locate(Kosh.RPMAxis, KOSH_GRID_RPM - 1, RPM, LastX) ||
+			y != kosh_cell_locate(Kosh.LoadAxis, KOSH_GRID_LOAD - 1, MAP, LastY) ||
+			x != bench_linear(Kosh.RPMAxis, KOSH_GRID_RPM - 1, RPM, &Probes[1]) ||
+			y != bench_linear(Kosh.LoadAxis, KOSH_GRID_LOAD - 1, MAP, &Probes[1])) {Mismatch++;}
+		LastX = x;
+		LastY = y;
+		for (int j = 0; j < 2; j++) {
+			Sum[j] += Probes[j];
+			if (Probes[j] > Max[j]) {Max[j] = Probes[j];}
+		}
+	}
+	printf("#   %-18s kosh_cell_locate mean %.1f max %d, linear mean %.1f max %d%s\n", Title,
+		(double) Sum[0] / BENCH_POINTS, Max[0], (double) Sum[1] / BENCH_POINTS, Max[1], Mismatch ? ", MISMATCH" : "");
+}
+
+// Наибольшее число чтений оси по всем значениям внутри сетки и всем
+// прошлым ячейкам (0 - прошлой ячейки нет)
+static void bench_probes_worst(const uint16_t *Axis, uint8_t Top, int *Locate, int *Linear) {
+	for (uint32_t Value = Axis[0] + 1; Value < Axis[Top]; Value++) {
+		int n = 0;
+		bench_linear(Axis, Top, Value, &n);
+		if (n > *Linear) {*Linear = n;}
+		for (uint8_t Last = 0; Last <= Top; Last++) {
+			n = 0;
+			bench_locate(Axis, Top, Value, Last, &n);
+			if (n > *Locate) {*Locate = n;}
+		}
+	}
+}
+
+// Случайные точки (переход в любую ячейку) и плавная траектория
+// (обороты и давление меняются понемногу от такта к такту)
+static void bench_probes(void) {
+	static BenchPoint_t Drive[BENCH_POINTS];
+	int32_t RPM = 800, MAP = 30 * 64;
+	for (int i = 0; i < BENCH_POINTS; i++) {
+		RPM += (int32_t) bench_rand(0, 100) - 50;
+		MAP += (int32_t) bench_rand(0, 128) - 64;
+		if (RPM < 700) {RPM = 700;}
+		if (RPM > 6500) {RPM = 6500;}
+		if (MAP < 20 * 64) {MAP = 20 * 64;}
+		if (MAP > 100 * 64) {MAP = 100 * 64;}
+		Drive[i].RPM = RPM;
+		Drive[i].MAP = MAP;
+	}
+	printf("# grid reads per kosh_find_cells (RPM + load), grid %dx%d:\n", KOSH_GRID_RPM, KOSH_GRID_LOAD);
+	bench_probes_run("random points:", Points);
+	bench_probes_run("drive trajectory:", Drive);
+	int Worst[2][2] = {{0, 0}, {0, 0}};
+	bench_probes_worst(Kosh.RPMAxis, KOSH_GRID_RPM - 1, &Worst[0][0], &Worst[0][1]);
+	bench_probes_worst(Kosh.LoadAxis, KOSH_GRID_LOAD - 1, &Worst[1][0], &Worst[1][1]);
+	printf("#   %-18s kosh_cell_locate %d, linear %d\n", "worst case:", Worst[0][0] + Worst[1][0], Worst[0][1] + Worst[1][1]);
+}
+
+// Счетчик событий процессора для текущего потока, -1 - недоступен
+static int bench_counter_open(uint64_t Config) {
+	struct perf_event_attr Attr;
+	memset(&Attr, 0, sizeof(Attr));
+	Attr.type = PERF_TYPE_HARDWARE;
+	Attr.size = sizeof(Attr);
+	Attr.config = Config;
+	Attr.disabled = 1;
+	Attr.exclude_kernel = 1;
+	Attr.exclude_hv = 1;
+	return (int) syscall(SYS_perf_event_open, &Attr, 0, -1, -1, 0);
+}
+
+static uint64_t bench_counter_read(int Fd) {
+	uint64_t Value = 0;
+	if (read(Fd, &Value, sizeof(Value)) != sizeof(Value)) {return 0;}
+	return Value;
+}
+
+static double bench_now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+	uint32_t Calls = 1 << 20;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+			case 'n': Calls = strtoul(optarg, NULL, 0); break;
+			default:
+				fprintf(stderr, "usage: bench [-n calls]\n");
+				return 2;
+		}
+	}
+
+	host_setup(1);
+	ltft_inst_init(&Kosh, &d, &fw_data, &Ego);
+	lambda_inst_init(&Ego, &d, &fw_data, &host_calib);
+	Ego.enabled[0] = 1;
+	kosh_axis_update(&Kosh);
+	bench_points();
+	bench_divs();
+	bench_cells();
+	bench_buffer();
+
+	int Instr = bench_counter_open(PERF_COUNT_HW_INSTRUCTIONS);
+	int Branch = bench_counter_open(PERF_COUNT_HW_BRANCH_INSTRUCTIONS);
+
+	printf("%-34s %10s %12s %12s\n", "function", "ns/call", "instr/call", "branch/call");
+	for (size_t c = 0; c < sizeof(Cases) / sizeof(Cases[0]); c++) {
+		// Прогрев
+		for (uint32_t i = 0; i < BENCH_POINTS; i++) {Cases[c].Run(i);}
+
+		if (Instr >= 0) {ioctl(Instr, PERF_EVENT_IOC_RESET, 0); ioctl(Instr, PERF_EVENT_IOC_ENABLE, 0);}
+		if (Branch >= 0) {ioctl(Branch, PERF_EVENT_IOC_RESET, 0); ioctl(Branch, PERF_EVENT_IOC_ENABLE, 0);}
+		double Start = bench_now();
+		for (uint32_t i = 0; i < Calls; i++) {Cases[c].Run(i);}
+		double Time = bench_now() - Start;
+		if (Instr >= 0) {ioctl(Instr, PERF_EVENT_IOC_DISABLE, 0);}
+		if (Branch >= 0) {ioctl(Branch, PERF_EVENT_IOC_DISABLE, 0);}
+
+		printf("%-34s %10.1f", Cases[c].Name, Time / Calls);
+		if (Instr >= 0) {printf(" %12.1f", (double) bench_counter_read(Instr) / Calls);}
+		else {printf(" %12s", "-");}
+		if (Branch >= 0) {printf(" %12.1f", (double) bench_counter_read(Branch) / Calls);}
+		else {printf(" %12s", "-");}
+		printf("\n");
+	}
+	if (Instr < 0 || Branch < 0) {
+		printf("# hardware counters are not available (perf_event_paranoid or virtualization)\n");
+	}
+	bench_accuracy();
+	bench_probes();
+	return 0;
+}
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Стоимость шага обучения в зависимости от размера сетки. bench собирается
+# для сеток 16x16, 24x24 и 32x32 (с флагами алгоритма из DEFS), для каждой
+# выводится время kosh_find_cells, kosh_rpm_map_calc и kosh_ltft_control
+# (нс на вызов и отношение к сетке 16x16) и число чтений сетки при поиске
+# ячеек: в среднем на плавной траектории и в худшем случае (через дробь -
+# у прежнего линейного поиска).
+#
+# DEFS="-DKOSH_ADAPTIVE" host/bench_grid.sh [вызовов]
+
+cd "$(dirname "$0")" || exit 1
+Calls=${1:-1000000}
+Out=$(mktemp) || exit 1
+trap 'rm -f "$Out"' EXIT
+
+printf "%-6s %18s %18s %18s %14s %12s\n" grid find_cells rpm_map_calc ltft_control "reads mean" "reads worst"
+for n in 16 24 32; do
+	make -s -B bench DEFS="$DEFS -DKOSH_GRID_RPM=$n -DKOSH_GRID_LOAD=$n" || exit 1
+	./bench -n "$Calls" > "$Out" || exit 1
+	awk -v Grid="${n}x${n}" '
+		$1 == "kosh_find_cells" {f = $2}
+		$1 == "kosh_rpm_map_calc" {r = $2}
+		$1 == "kosh_ltft_control" {l = $2}
+		/drive trajectory:/ {m = $6}
+		/worst case:/ {w = $5; sub(",", "", w); w = w "/" $7}
+		END {printf "%-6s %18s %18s %18s %14s %12s\n", Grid, f, r, l, m, w}
+	' "$Out"
+done | awk '
+	NR == 1 {f0 = $2; r0 = $3; l0 = $4}
+	{printf "%-6s %10.1f (%4.2f) %10.1f (%4.2f) %10.1f (%4.2f) %14s %12s\n", $1, $2, $2 / f0, $3, $3 / r0, $4, $4 / l0, $5, $6}
+'
+
+# Обычная сборка bench
+make -s -B bench DEFS="$DEFS"
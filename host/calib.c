@@ -0,0 +1,172 @@
+// Калибровка по нескольким логам. Каждый лог прогоняется в своем потоке
+// через свои экземпляры лямбда коррекции и LTFT (lambda_inst_*, ltft_inst_*)
+// с одной начальной калибровкой, затем таблицы LTFT объединяются по
+// ячейкам: среднее значений логов с весом по числу попаданий в ячейку
+// (Kosh_t::Hits при KOSH_ADAPTIVE, иначе число шагов обучения, засчитанных
+// ячейке прогоном). Ячейка, в которую не попал ни один лог, - простое среднее.
+//
+// calib [-n] [-c цилиндры] [-p параметры] [-v VE] [-l LTFT] лог...
+//	ключи и форматы - как у replay
+// Результат - объединенные таблицы LTFT обоих каналов в процентах и
+// суммарные веса ячеек.
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "host.h"
+#include "hostreplay.h"
+#include "lambda.h"
+#include "ltft.h"
+
+static int calib_usage(void) {
+	fprintf(stderr, "usage: calib [-n] [-c cylinders] [-p params] [-v ve_table] [-l ltft_table] log...\n");
+	return 2;
+}
+
+// Прогон одного лога в своем потоке
+typedef struct {
+	const char *Path;
+	pthread_t Thread;
+	uint8_t Io;					// Входы host_io потока настройки
+	int Status;					// 0 - лог прогнан, -1 - не открылся
+	struct ecudata_t ecu;		// Копия данных ЭБУ после настройки
+	lambda_state_t Ego;
+	Kosh_t Kosh;
+	HostReplay_t Run;
+} CalibEngine_t;
+
+static void *calib_thread(void *Arg) {
+	CalibEngine_t *Eng = Arg;
+
+	host_io = Eng->Io;
+	host_opcode = 0;
+	host_time = 0;
+	lambda_inst_init(&Eng->Ego, &Eng->ecu, &fw_data, &host_calib);
+	ltft_inst_init(&Eng->Kosh, &Eng->ecu, &fw_data, &Eng->Ego);
+
+	HostLogSrc_t Src;
+	if (host_log_open(&Src, Eng->Path)) {
+		Eng->Status = -1;
+		return NULL;
+	}
+	Eng->Run.ecu = &Eng->ecu;
+	Eng->Run.Ego = &Eng->Ego;
+	Eng->Run.Kosh = &Eng->Kosh;
+	host_replay_run(&Eng->Run, &Src);
+	host_log_close(&Src);
+	return NULL;
+}
+
+// Вес ячейки лога в объединенной таблице
+static uint32_t calib_weight(const CalibEngine_t *Eng, uint8_t Channel, uint8_t y, uint8_t x) {
+	#ifdef KOSH_ADAPTIVE
+		return Eng->Kosh.Hits[Channel][y][x];
+	#else
+		return Eng->Run.Visits[Channel][y][x];
+	#endif
+}
+
+// Объединение таблиц канала Channel в Table, суммарные веса - в Weights
+static void calib_merge(const CalibEngine_t *Engs, int Count, uint8_t Channel, int8_t (*Table)[KOSH_GRID_RPM], uint32_t (*Weights)[KOSH_GRID_RPM]) {
+	for (uint8_t y = 0; y < KOSH_GRID_LOAD; y++) {
+		for (uint8_t x = 0; x < KOSH_GRID_RPM; x++) {
+			int64_t Sum = 0;
+			int64_t Plain = 0;
+			uint32_t W = 0;
+			for (int i = 0; i < Count; i++) {
+				int8_t Value = Channel ? Engs[i].ecu.inj_ltft2[y][x] : Engs[i].ecu.inj_ltft1[y][x];
+				uint32_t w = calib_weight(&Engs[i], Channel, y, x);
+				Sum += (int64_t) w * Value;
+				Plain += Value;
+				W += w;
+			}
+			Table[y][x] = (int8_t) (W ? lround((double) Sum / W) : lround((double) Plain / Count));
+			Weights[y][x] = W;
+		}
+	}
+}
+
+static void calib_weights_print(const char *Title, uint32_t (*Weights)[KOSH_GRID_RPM]) {
+	printf("%s\n", Title);
+	for (int y = KOSH_GRID_LOAD - 1; y >= 0; y--) {
+		for (int x = 0; x < KOSH_GRID_RPM; x++) {
+			printf("%6u", Weights[y][x]);
+		}
+		printf("\n");
+	}
+}
+
+int main(int argc, char **argv) {
+	uint8_t Senstype = 1;
+	int Cylinders = 4;
+	const char *ParamsPath = NULL;
+	const char *VEPath = NULL;
+	const char *LTFTPath = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "nc:p:v:l:")) != -1) {
+		switch (opt) {
+			case 'n': Senstype = 0; break;
+			case 'c': Cylinders = atoi(optarg); break;
+			case 'p': ParamsPath = optarg; break;
+			case 'v': VEPath = optarg; break;
+			case 'l': LTFTPath = optarg; break;
+			default: return calib_usage();
+		}
+	}
+	if (optind >= argc || Cylinders < 1) {return calib_usage();}
+
+	host_setup(Senstype);
+	if (ParamsPath && host_params_read(ParamsPath)) {return 1;}
+	if (VEPath && host_ve_load(VEPath)) {return 1;}
+	if (LTFTPath && host_ltft_load(LTFTPath, d.inj_ltft1)) {return 1;}
+
+	// Калибровка (fw_data) и таблицы VE после настройки только читаются
+	// и общие для всех потоков, данные ЭБУ у каждого потока свои
+	int Count = argc - optind;
+	CalibEngine_t *Engs = calloc(Count, sizeof(CalibEngine_t));
+	if (!Engs) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	struct timespec Start, End;
+	clock_gettime(CLOCK_MONOTONIC, &Start);
+	for (int i = 0; i < Count; i++) {
+		CalibEngine_t *Eng = &Engs[i];
+		Eng->Path = argv[optind + i];
+		Eng->Io = host_io;
+		Eng->ecu = d;
+		Eng->Run.Cylinders = Cylinders;
+		if (pthread_create(&Eng->Thread, NULL, calib_thread, Eng)) {
+			fprintf(stderr, "%s: cannot start thread\n", Eng->Path);
+			return 1;
+		}
+	}
+	int Failed = 0;
+	for (int i = 0; i < Count; i++) {
+		pthread_join(Engs[i].Thread, NULL);
+		if (Engs[i].Status) {Failed = 1;}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &End);
+	if (Failed) {return 1;}
+
+	for (int i = 0; i < Count; i++) {
+		const HostReplay_t *Run = &Engs[i].Run;
+		printf("# %s: %u strokes, %u learning steps, %.1f s of log\n", Engs[i].Path, Run->Strokes, Run->Steps, Run->TimeMs / 1000.0);
+	}
+	printf("# %d logs on %d threads in %.3f s\n", Count, Count,
+		(End.tv_sec - Start.tv_sec) + (End.tv_nsec - Start.tv_nsec) / 1e9);
+
+	static uint32_t Weights[KOSH_GRID_LOAD][KOSH_GRID_RPM];
+	calib_merge(Engs, Count, 0, d.inj_ltft1, Weights);
+	host_ltft_print("# LTFT 1, %", d.inj_ltft1);
+	calib_weights_print("# LTFT 1 weights", Weights);
+	calib_merge(Engs, Count, 1, d.inj_ltft2, Weights);
+	host_ltft_print("# LTFT 2, %", d.inj_ltft2);
+	calib_weights_print("# LTFT 2 weights", Weights);
+	free(Engs);
+	return 0;
+}
@@ -0,0 +1,336 @@
+// Заглушки функций прошивки и настройки по умолчанию для хост-сборки
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "host.h"
+#include "eeprom.h"
+#include "funconv.h"
+#include "ioconfig.h"
+#include "magnitude.h"
+#include "vstimer.h"
+
+struct ecudata_t d;
+struct fw_data_t fw_data;
+struct f_data_t host_tables;
+__thread uint16_t host_time;
+__thread uint8_t host_opcode;
+__thread uint8_t host_io;
+
+// Чтение таблицы по смещению в struct f_data_t, как mm_ptr12 прошивки
+static uint16_t host_mm_ptr12(uint16_t Offset, uint16_t Index) {
+	const uint16_t *Table = (const uint16_t *) ((const uint8_t *) &host_tables + Offset);
+	return Table[Index] & 0x0FFF;
+}
+
+uint16_t s_timer_gtc(void) {
+	return host_time;
+}
+
+uint8_t eeprom_get_pending_opcode(void) {
+	return host_opcode;
+}
+
+uint8_t io_check(uint8_t Iop) {
+	return (host_io >> Iop) & 1;
+}
+
+static int16_t host_curve_min(const struct fw_data_t *fw) {
+	(void) fw;
+	return AFRVAL_MAG(10.0);
+}
+
+static int16_t host_curve_max(const struct fw_data_t *fw) {
+	(void) fw;
+	return AFRVAL_MAG(17.0);
+}
+
+static uint8_t host_zone_val(struct ecudata_t *ecu, const struct fw_data_t *fw) {
+	(void) ecu;
+	(void) fw;
+	return 1;
+}
+
+const lambda_calib_t host_calib = {host_curve_min, host_curve_max, host_zone_val};
+
+int16_t ego_curve_min(void) {
+	return host_curve_min(&fw_data);
+}
+
+int16_t ego_curve_max(void) {
+	return host_curve_max(&fw_data);
+}
+
+uint8_t lambda_zone_val(void) {
+	return host_zone_val(&d, &fw_data);
+}
+
+void host_setup(uint8_t Senstype) {
+	struct exdata_t *ex = &fw_data.exdata;
+
+	memset(&d, 0, sizeof(d));
+	memset(&fw_data, 0, sizeof(fw_data));
+	memset(&host_tables, 0, sizeof(host_tables));
+	host_time = 0;
+	host_opcode = 0;
+	host_io = 1 << IOP_LAMBDA;
+
+	// Сетка оборотов 600...7500, шаг растет с оборотами, как в прошивке
+	for (int i = 0; i < KOSH_GRID_RPM; i++) {
+		ex->rpm_grid_points[i] = (uint16_t) lround(600.0 * pow(7500.0 / 600.0, (double) i / (KOSH_GRID_RPM - 1)));
+	}
+	for (int i = 0; i < KOSH_GRID_RPM - 1; i++) {
+		ex->rpm_grid_sizes[i] = ex->rpm_grid_points[i + 1] - ex->rpm_grid_points[i];
+	}
+
+	// Давление 20...100 кПа, своя сетка совпадает с равномерной
+	d.param.load_lower = 20 * 64;
+	d.param.load_upper = 100 * 64;
+	uint16_t Step = (d.param.load_upper - d.param.load_lower) / (KOSH_GRID_LOAD - 1);
+	for (int i = 0; i < KOSH_GRID_LOAD; i++) {
+		ex->load_grid_points[i] = d.param.load_lower + i * Step;
+		ex->load_grid_sizes[i] = Step;
+	}
+
+	// Задержка ответа датчика в тактах по 16 точкам давления:
+	// на малой нагрузке газы идут до датчика дольше
+	for (int i = 0; i < 16; i++) {
+		ex->inj_aftstr_strk1[i] = 24 - i;
+	}
+
+	ex->ltft_min = -100;
+	ex->ltft_max = 100;
+	ex->ltft_learn_clt = 70 * 4;
+	ex->ltft_on_idling = 1;
+	ex->ltft_mode = 3;
+
+	d.param.ve2_map_func = VE2MF_1ST;
+	d.param.inj_lambda_senstype = Senstype;
+	d.param.inj_lambda_flags = 1 << LAMFLG_IDLCORR;
+	d.param.lambda_selch = 0;
+	d.param.inj_lambda_swt_point = 180;		// 0.45 В
+	d.param.inj_lambda_step_size_m = 2;
+	d.param.inj_lambda_step_size_p = 2;
+	d.param.inj_lambda_corr_limit_m = 128;
+	d.param.inj_lambda_corr_limit_p = 128;
+	d.param.gd_lambda_corr_limit_m = 128;
+	d.param.gd_lambda_corr_limit_p = 128;
+	d.param.gd_lambda_stoichval = AFRVAL_MAG(15.6);
+	d.param.inj_lambda_rpm_thrd = 1000;
+	d.param.inj_lambda_temp_thrd = 60 * 4;
+	d.param.inj_lambda_str_per_stp = 2;
+
+	d.sens.temperat = 90 * 4;
+	d.sens.air_temp = 30 * 4;
+	d.sens.carb = 1;
+	d.corr.afr = AFRVAL_MAG(14.7);
+	d.mm_ptr12 = host_mm_ptr12;
+	d.engine_mode = EM_WORK;
+	d.ie_valve = 1;
+
+	for (int i = 0; i < KOSH_GRID_LOAD * KOSH_GRID_RPM; i++) {
+		host_tables.inj_ve[i] = 1638;
+		host_tables.inj_ve2[i] = 2048;
+	}
+}
+
+// Параметры, которые читает host_params_read(): значение в файле
+// умножается на Scale и округляется, выход за диапазон типа - ошибка
+typedef struct {
+	const char *Name;
+	void *Ptr;
+	uint8_t Type;		// HOST_xxx
+	uint8_t Count;		// Число значений
+	double Scale;		// Множитель физической величины в единицы прошивки
+} HostParam_t;
+
+#define HOST_U8  0
+#define HOST_I8  1
+#define HOST_U16 2
+#define HOST_I16 3
+
+static const HostParam_t host_params[] = {
+	// Сетки: об/мин, кПа. Своя сетка давления включает FUNC_LDAX_GRID
+	{"rpm_grid", fw_data.exdata.rpm_grid_points, HOST_U16, KOSH_GRID_RPM, 1},
+	{"load_grid", fw_data.exdata.load_grid_points, HOST_U16, KOSH_GRID_LOAD, 64},
+	{"load_lower", &d.param.load_lower, HOST_U16, 1, 64},
+	{"load_upper", &d.param.load_upper, HOST_U16, 1, 64},
+	// Задержка ответа датчика, такты по 16 точкам давления
+	{"inj_aftstr_strk1", fw_data.exdata.inj_aftstr_strk1, HOST_U8, 16, 1},
+	// LTFT: пределы %, температура °C, давление газа кПа
+	{"ltft_min", &fw_data.exdata.ltft_min, HOST_I8, 1, 5.12},
+	{"ltft_max", &fw_data.exdata.ltft_max, HOST_I8, 1, 5.12},
+	{"ltft_learn_clt", &fw_data.exdata.ltft_learn_clt, HOST_I16, 1, 4},
+	{"ltft_learn_gpa", &fw_data.exdata.ltft_learn_gpa, HOST_U16, 1, 64},
+	{"ltft_learn_gpd", &fw_data.exdata.ltft_learn_gpd, HOST_U16, 1, 64},
+	{"ltft_on_idling", &fw_data.exdata.ltft_on_idling, HOST_U8, 1, 1},
+	{"ltft_mode", &fw_data.exdata.ltft_mode, HOST_U8, 1, 1},
+	{"ve2_map_func", &d.param.ve2_map_func, HOST_U8, 1, 1},
+	// Лямбда коррекция: напряжение В, шаг и пределы %, AFR, об/мин, °C,
+	// задержка включения с, время шага мс
+	{"inj_lambda_senstype", &d.param.inj_lambda_senstype, HOST_U8, 1, 1},
+	{"inj_lambda_flags", &d.param.inj_lambda_flags, HOST_U8, 1, 1},
+	{"lambda_selch", &d.param.lambda_selch, HOST_U8, 1, 1},
+	{"inj_lambda_activ_delay", &d.param.inj_lambda_activ_delay, HOST_U8, 1, 1},
+	{"inj_lambda_swt_point", &d.param.inj_lambda_swt_point, HOST_U16, 1, 400},
+	{"inj_lambda_dead_band", &d.param.inj_lambda_dead_band, HOST_U16, 1, 400},
+	{"inj_lambda_step_size_m", &d.param.inj_lambda_step_size_m, HOST_U8, 1, 5.12},
+	{"inj_lambda_step_size_p", &d.param.inj_lambda_step_size_p, HOST_U8, 1, 5.12},
+	{"inj_lambda_corr_limit_m", &d.param.inj_lambda_corr_limit_m, HOST_U16, 1, 5.12},
+	{"inj_lambda_corr_limit_p", &d.param.inj_lambda_corr_limit_p, HOST_U16, 1, 5.12},
+	{"gd_lambda_corr_limit_m", &d.param.gd_lambda_corr_limit_m, HOST_U16, 1, 5.12},
+	{"gd_lambda_corr_limit_p", &d.param.gd_lambda_corr_limit_p, HOST_U16, 1, 5.12},
+	{"gd_lambda_stoichval", &d.param.gd_lambda_stoichval, HOST_I16, 1, 128},
+	{"inj_lambda_rpm_thrd", &d.param.inj_lambda_rpm_thrd, HOST_U16, 1, 1},
+	{"inj_lambda_temp_thrd", &d.param.inj_lambda_temp_thrd, HOST_I16, 1, 4},
+	{"inj_lambda_str_per_stp", &d.param.inj_lambda_str_per_stp, HOST_U8, 1, 1},
+	{"inj_lambda_ms_per_stp", &d.param.inj_lambda_ms_per_stp, HOST_U16, 1, 0.1},
+	{"idlreg_turn_on_temp", &d.param.idlreg_turn_on_temp, HOST_I16, 1, 4},
+};
+
+// Запись значения v (уже в единицах прошивки) в элемент i параметра.
+// return 0 - значение вне диапазона типа
+static int host_param_store(const HostParam_t *Par, int i, long v) {
+	switch (Par->Type) {
+		case HOST_U8:
+			if (v < 0 || v > UINT8_MAX) {return 0;}
+			((uint8_t *) Par->Ptr)[i] = (uint8_t) v;
+			return 1;
+		case HOST_I8:
+			if (v < INT8_MIN || v > INT8_MAX) {return 0;}
+			((int8_t *) Par->Ptr)[i] = (int8_t) v;
+			return 1;
+		case HOST_U16:
+			if (v < 0 || v > UINT16_MAX) {return 0;}
+			((uint16_t *) Par->Ptr)[i] = (uint16_t) v;
+			return 1;
+		default:
+			if (v < INT16_MIN || v > INT16_MAX) {return 0;}
+			((int16_t *) Par->Ptr)[i] = (int16_t) v;
+			return 1;
+	}
+}
+
+int host_params_read(const char *Path) {
+	FILE *f = fopen(Path, "r");
+	if (!f) {
+		perror(Path);
+		return -1;
+	}
+
+	char Line[4096];
+	int LineNo = 0;
+	int Error = 0;
+	while (!Error && fgets(Line, sizeof(Line), f)) {
+		LineNo++;
+		char *p = Line + strspn(Line, " \t");
+		if (*p == '#' || *p == '\r' || *p == '\n' || !*p) {continue;}
+
+		size_t Len = strcspn(p, " \t=,;\r\n");
+		const HostParam_t *Par = NULL;
+		for (size_t k = 0; k < sizeof(host_params) / sizeof(host_params[0]); k++) {
+			if (strlen(host_params[k].Name) == Len && !strncmp(host_params[k].Name, p, Len)) {Par = &host_params[k];}
+		}
+		if (!Par) {
+			fprintf(stderr, "%s:%d: unknown parameter %.*s\n", Path, LineNo, (int) Len, p);
+			Error = 1;
+			break;
+		}
+		p += Len;
+
+		int n = 0;
+		while (n < Par->Count) {
+			p += strspn(p, " \t=,;\r\n");
+			char *End;
+			double v = strtod(p, &End);
+			if (End == p) {break;}
+			if (!host_param_store(Par, n, lround(v * Par->Scale))) {
+				fprintf(stderr, "%s:%d: %s = %g is out of range\n", Path, LineNo, Par->Name, v);
+				Error = 1;
+				break;
+			}
+			n++;
+			p = End;
+		}
+		if (!Error && n != Par->Count) {
+			fprintf(stderr, "%s:%d: %s expects %d values\n", Path, LineNo, Par->Name, Par->Count);
+			Error = 1;
+		}
+		if (!Error && Par->Ptr == fw_data.exdata.load_grid_points) {
+			d.param.func_flags |= (1 << FUNC_LDAX_GRID);
+		}
+	}
+	fclose(f);
+	if (Error) {return -1;}
+
+	// Размеры ячеек по точкам сеток
+	struct exdata_t *ex = &fw_data.exdata;
+	for (int i = 0; i < KOSH_GRID_RPM - 1; i++) {
+		ex->rpm_grid_sizes[i] = ex->rpm_grid_points[i + 1] - ex->rpm_grid_points[i];
+	}
+	for (int i = 0; i < KOSH_GRID_LOAD - 1; i++) {
+		ex->load_grid_sizes[i] = ex->load_grid_points[i + 1] - ex->load_grid_points[i];
+	}
+	return 0;
+}
+
+int host_table_read(const char *Path, double *Out, int Count) {
+	FILE *f = fopen(Path, "r");
+	if (!f) {return -1;}
+
+	char Line[1024];
+	int n = 0;
+	while (n < Count && fgets(Line, sizeof(Line), f)) {
+		if (Line[0] == '#') {continue;}
+		char *p = Line;
+		while (n < Count) {
+			p += strspn(p, " \t,;\r\n");
+			if (!*p) {break;}
+			char *End;
+			Out[n] = strtod(p, &End);
+			if (End == p) {break;}
+			n++;
+			p = End;
+		}
+	}
+	fclose(f);
+	return n;
+}
+
+int host_ve_load(const char *Path) {
+	static double Table[KOSH_GRID_LOAD * KOSH_GRID_RPM];
+	if (host_table_read(Path, Table, KOSH_GRID_LOAD * KOSH_GRID_RPM) != KOSH_GRID_LOAD * KOSH_GRID_RPM) {
+		fprintf(stderr, "%s: expected %d values\n", Path, KOSH_GRID_LOAD * KOSH_GRID_RPM);
+		return -1;
+	}
+	for (int i = 0; i < KOSH_GRID_LOAD * KOSH_GRID_RPM; i++) {
+		host_tables.inj_ve[i] = (uint16_t) (Table[i] * 2048 + 0.5);
+	}
+	return 0;
+}
+
+int host_ltft_load(const char *Path, int8_t (*Table)[KOSH_GRID_RPM]) {
+	static double Values[KOSH_GRID_LOAD * KOSH_GRID_RPM];
+	if (host_table_read(Path, Values, KOSH_GRID_LOAD * KOSH_GRID_RPM) != KOSH_GRID_LOAD * KOSH_GRID_RPM) {
+		fprintf(stderr, "%s: expected %d values\n", Path, KOSH_GRID_LOAD * KOSH_GRID_RPM);
+		return -1;
+	}
+	for (int i = 0; i < KOSH_GRID_LOAD * KOSH_GRID_RPM; i++) {
+		long v = lround(Values[i] * 512 / 100);
+		if (v < fw_data.exdata.ltft_min) {v = fw_data.exdata.ltft_min;}
+		if (v > fw_data.exdata.ltft_max) {v = fw_data.exdata.ltft_max;}
+		Table[i / KOSH_GRID_RPM][i % KOSH_GRID_RPM] = (int8_t) v;
+	}
+	return 0;
+}
+
+void host_ltft_print(const char *Title, int8_t (*Table)[KOSH_GRID_RPM]) {
+	printf("%s\n", Title);
+	for (int y = KOSH_GRID_LOAD - 1; y >= 0; y--) {
+		for (int x = 0; x < KOSH_GRID_RPM; x++) {
+			printf("%6.1f", Table[y][x] * 100.0 / 512);
+		}
+		printf("\n");
+	}
+}
@@ -0,0 +1,54 @@
+// Общая часть хост-сборки: заглушки функций прошивки, данные ЭБУ
+// и настройки по умолчанию для прогона lambda.c и ltft.c на ПК.
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include <stdint.h>
+#include "ecudata.h"
+#include "lambda.h"
+
+// Таблицы VE, которые читает d.mm_ptr12
+extern struct f_data_t host_tables;
+// Системный таймер s_timer_gtc(), тики 10 мс, ведется вызывающим кодом.
+// Таймер, операция EEPROM и входы - свои у каждого потока, поток с
+// экземплярами копирует их из потока, который выполнил host_setup().
+extern __thread uint16_t host_time;
+// Ожидающая операция EEPROM (OPCODE_xxx), 0 - нет
+extern __thread uint8_t host_opcode;
+// Подключенные входы, бит на IOP_xxx
+extern __thread uint8_t host_io;
+
+// Функции калибровки лямбда коррекции для экземпляров со своими данными
+// (lambda_inst_init()): те же значения, что у заглушек funconv.h
+extern const lambda_calib_t host_calib;
+
+// Настройки по умолчанию: сетки, параметры лямбда коррекции и LTFT,
+// VE = 0.8 во всех ячейках, пустые таблицы LTFT. Senstype: 0 - УДК, 1 - ШДК
+void host_setup(uint8_t Senstype);
+
+// Чтение калибровки ЭБУ поверх настроек по умолчанию: строка на параметр,
+// имя как в прошивке и значения в физических единицах (см. host.c),
+// строки с # пропускаются. Сетки, задержка, пределы LTFT и параметры
+// лямбда коррекции берутся из файла, остальное остается по умолчанию.
+// return 0 - прочитан, -1 - ошибка (сообщение выведено в stderr)
+int host_params_read(const char *Path);
+
+// Чтение таблицы Count чисел из текстового файла (разделители - пробелы,
+// запятые, точки с запятой, строки с # пропускаются)
+// return число прочитанных значений, -1 - файл не открылся
+int host_table_read(const char *Path, double *Out, int Count);
+
+// Таблица VE (доли: 0.85, строки от меньшего давления) в host_tables
+// return 0 - прочитана, -1 - ошибка (сообщение выведено в stderr)
+int host_ve_load(const char *Path);
+
+// Таблица LTFT в процентах, так же. Значения округляются и ограничиваются
+// пределами LTFT калибровки.
+// return 0 - прочитана, -1 - ошибка (сообщение выведено в stderr)
+int host_ltft_load(const char *Path, int8_t (*Table)[KOSH_GRID_RPM]);
+
+// Вывод таблицы LTFT (x512) в процентах, строки от большего давления к меньшему
+void host_ltft_print(const char *Title, int8_t (*Table)[KOSH_GRID_RPM]);
+
+#endif
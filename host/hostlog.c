@@ -0,0 +1,153 @@
+// Чтение и запись логов для прогона (формат - в hostlog.h)
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hostlog.h"
+
+// Число полей строки текстового лога
+#define HOST_LOG_FIELDS 15
+
+int host_log_map(HostLog_t *Log, const char *Path) {
+	memset(Log, 0, sizeof(HostLog_t));
+
+	int fd = open(Path, O_RDONLY);
+	if (fd < 0) {
+		perror(Path);
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		perror(Path);
+		close(fd);
+		return -1;
+	}
+
+	// Короткий файл или файл без сигнатуры - текстовый лог
+	HostLogHeader_t Header;
+	if ((size_t) st.st_size < sizeof(Header) || pread(fd, &Header, sizeof(Header), 0) != (ssize_t) sizeof(Header) ||
+		memcmp(Header.Magic, HOST_LOG_MAGIC, sizeof(Header.Magic))) {
+		close(fd);
+		return 1;
+	}
+
+	size_t RecSize = 0;
+	#define HOST_LOG_SIZE(Type, Field) RecSize += sizeof(Type);
+	HOST_LOG_COLUMNS(HOST_LOG_SIZE)
+	#undef HOST_LOG_SIZE
+	if (Header.Version != HOST_LOG_VERSION || (size_t) st.st_size != sizeof(Header) + (size_t) Header.Count * RecSize) {
+		fprintf(stderr, "%s: unsupported version or truncated log\n", Path);
+		close(fd);
+		return -1;
+	}
+
+	void *Base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (Base == MAP_FAILED) {
+		perror(Path);
+		return -1;
+	}
+	madvise(Base, st.st_size, MADV_SEQUENTIAL);
+
+	Log->Base = Base;
+	Log->Size = st.st_size;
+	Log->Count = Header.Count;
+	const uint8_t *p = (const uint8_t *) Base + sizeof(Header);
+	#define HOST_LOG_MAP(Type, Field) Log->Field = (const Type *) p; p += (size_t) Header.Count * sizeof(Type);
+	HOST_LOG_COLUMNS(HOST_LOG_MAP)
+	#undef HOST_LOG_MAP
+	return 0;
+}
+
+void host_log_unmap(HostLog_t *Log) {
+	if (Log->Base) {munmap(Log->Base, Log->Size);}
+	memset(Log, 0, sizeof(HostLog_t));
+}
+
+int host_log_open(HostLogSrc_t *Src, const char *Path) {
+	Src->Index = 0;
+	Src->f = NULL;
+	int Mapped = host_log_map(&Src->Log, Path);
+	if (Mapped <= 0) {return Mapped;}
+	Src->f = fopen(Path, "r");
+	if (!Src->f) {
+		perror(Path);
+		return -1;
+	}
+	return 0;
+}
+
+int host_log_next(HostLogSrc_t *Src, HostLogRec_t *Rec) {
+	if (!Src->f) {
+		if (Src->Index >= Src->Log.Count) {return -1;}
+		host_log_get(&Src->Log, Src->Index++, Rec);
+		return 1;
+	}
+	return host_log_csv_read(Src->f, Rec);
+}
+
+void host_log_close(HostLogSrc_t *Src) {
+	if (Src->f) {fclose(Src->f);}
+	Src->f = NULL;
+	host_log_unmap(&Src->Log);
+}
+
+int host_log_csv_read(FILE *f, HostLogRec_t *Rec) {
+	char Line[1024];
+	if (!fgets(Line, sizeof(Line), f)) {return -1;}
+	if (Line[0] == '#') {return 0;}
+
+	// Пропущенные поля в конце строки: дроссель открыт, остальное 0
+	double v[HOST_LOG_FIELDS] = {0};
+	v[9] = 1;
+	char *p = Line;
+	int n = 0;
+	while (n < HOST_LOG_FIELDS) {
+		p += strspn(p, " \t,;\r\n");
+		char *End;
+		double x = strtod(p, &End);
+		if (End == p) {break;}
+		v[n++] = x;
+		p = End;
+	}
+	// Заголовок или пустая строка
+	if (n < 3) {return 0;}
+
+	Rec->Time = (uint32_t) v[0];
+	Rec->RPM = (uint16_t) v[1];
+	Rec->MAP = (uint16_t) (v[2] * 64);
+	Rec->CLT = (int16_t) (v[3] * 4);
+	Rec->IAT = (int16_t) (v[4] * 4);
+	Rec->EGO[0] = (uint16_t) (v[5] * 400);
+	Rec->EGO[1] = (uint16_t) (v[6] * 400);
+	Rec->AFR[0] = (uint16_t) (v[7] * 128);
+	Rec->AFR[1] = (uint16_t) (v[8] * 128);
+	Rec->Carb = v[9] != 0;
+	Rec->Gas = v[10] != 0;
+	Rec->TargetAFR = (int16_t) (v[11] * 128);
+	Rec->FuelCut = (uint8_t) v[12];
+	Rec->Accel = v[13] != 0;
+	Rec->MAP2 = (uint16_t) (v[14] * 64);
+	return 1;
+}
+
+int host_log_write(FILE *f, const HostLogRec_t *Recs, uint32_t Count) {
+	HostLogHeader_t Header;
+	memset(&Header, 0, sizeof(Header));
+	memcpy(Header.Magic, HOST_LOG_MAGIC, sizeof(Header.Magic));
+	Header.Version = HOST_LOG_VERSION;
+	Header.Count = Count;
+	if (fwrite(&Header, sizeof(Header), 1, f) != 1) {return -1;}
+
+	// Колонка за колонкой, через буфер stdio
+	#define HOST_LOG_PUT(Type, Field) \
+		for (uint32_t i = 0; i < Count; i++) { \
+			if (fwrite(&Recs[i].Field, sizeof(Type), 1, f) != 1) {return -1;} \
+		}
+	HOST_LOG_COLUMNS(HOST_LOG_PUT)
+	#undef HOST_LOG_PUT
+	return 0;
+}
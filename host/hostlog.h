@@ -0,0 +1,122 @@
+// Записи лога для прогона: текстовый (CSV) и двоичный колоночный формат.
+//
+// Двоичный лог - заголовок HostLogHeader_t и колонки по Count значений
+// в единицах прошивки, в порядке HOST_LOG_COLUMNS: сначала 32-битные,
+// затем 16-битные, затем байтовые, поэтому каждая колонка выровнена по
+// своему типу. Порядок байт - как у хоста (little-endian). Файл
+// отображается в память целиком, записи читаются прямо из страниц
+// файла без разбора и без выделения памяти.
+
+#ifndef _HOSTLOG_H_
+#define _HOSTLOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define HOST_LOG_MAGIC "SECU3LOG"
+#define HOST_LOG_VERSION 1
+
+// Запись лога в единицах прошивки
+typedef struct {
+	uint32_t Time;			// Время, мс
+	uint16_t RPM;			// Обороты
+	uint16_t MAP;			// Давление x64
+	uint16_t MAP2;			// Давление газа x64
+	uint16_t EGO[2];		// Напряжение УДК x400
+	uint16_t AFR[2];		// AFR ШДК x128
+	int16_t CLT;			// Температура ОЖ x4
+	int16_t IAT;			// Температура воздуха x4
+	int16_t TargetAFR;		// Целевой AFR x128, 0 - стехиометрия топлива
+	uint8_t Carb;			// Дроссель: 0 - ХХ
+	uint8_t Gas;			// Газ
+	uint8_t FuelCut;		// Отсечка: 0 - нет, 1 - принудительный ХХ, 2 - ограничитель оборотов
+	uint8_t Accel;			// Обогащение при ускорении
+} HostLogRec_t;
+
+// Заголовок двоичного лога, 32 байта
+typedef struct {
+	char Magic[8];			// HOST_LOG_MAGIC без завершающего нуля
+	uint32_t Version;		// HOST_LOG_VERSION
+	uint32_t Count;			// Число записей
+	uint32_t Reserved[4];
+} HostLogHeader_t;
+
+// Колонки двоичного лога: поле записи и тип
+#define HOST_LOG_COLUMNS(X) \
+	X(uint32_t, Time) \
+	X(uint16_t, RPM) \
+	X(uint16_t, MAP) \
+	X(uint16_t, MAP2) \
+	X(uint16_t, EGO[0]) \
+	X(uint16_t, EGO[1]) \
+	X(uint16_t, AFR[0]) \
+	X(uint16_t, AFR[1]) \
+	X(int16_t, CLT) \
+	X(int16_t, IAT) \
+	X(int16_t, TargetAFR) \
+	X(uint8_t, Carb) \
+	X(uint8_t, Gas) \
+	X(uint8_t, FuelCut) \
+	X(uint8_t, Accel)
+
+// Отображенный в память двоичный лог: указатели на колонки
+typedef struct {
+	uint32_t Count;
+	const uint32_t *Time;
+	const uint16_t *RPM;
+	const uint16_t *MAP;
+	const uint16_t *MAP2;
+	const uint16_t *EGO[2];
+	const uint16_t *AFR[2];
+	const int16_t *CLT;
+	const int16_t *IAT;
+	const int16_t *TargetAFR;
+	const uint8_t *Carb;
+	const uint8_t *Gas;
+	const uint8_t *FuelCut;
+	const uint8_t *Accel;
+	void *Base;				// Начало отображения
+	size_t Size;			// Размер отображения
+} HostLog_t;
+
+// Отображение двоичного лога в память
+// return 0 - лог отображен, 1 - файл не двоичный лог (CSV), -1 - ошибка
+// (сообщение выведено в stderr)
+int host_log_map(HostLog_t *Log, const char *Path);
+
+void host_log_unmap(HostLog_t *Log);
+
+// Запись i отображенного лога
+static inline void host_log_get(const HostLog_t *Log, uint32_t i, HostLogRec_t *Rec) {
+	#define HOST_LOG_GET(Type, Field) Rec->Field = Log->Field[i];
+	HOST_LOG_COLUMNS(HOST_LOG_GET)
+	#undef HOST_LOG_GET
+}
+
+// Источник записей: отображенный в память двоичный лог или CSV
+typedef struct {
+	HostLog_t Log;
+	uint32_t Index;
+	FILE *f;				// Текстовый лог, NULL - двоичный
+} HostLogSrc_t;
+
+// Открытие лога: двоичный отображается в память, иначе читается как CSV
+// return 0 - открыт, -1 - ошибка (сообщение выведено в stderr)
+int host_log_open(HostLogSrc_t *Src, const char *Path);
+
+// Следующая запись. return 1 - запись, 0 - строка пропущена, -1 - конец лога
+int host_log_next(HostLogSrc_t *Src, HostLogRec_t *Rec);
+
+void host_log_close(HostLogSrc_t *Src);
+
+// Чтение записи текстового лога (поля - в начале replay.c), физические
+// величины переводятся в единицы прошивки
+// return 1 - запись, 0 - строка пропущена, -1 - конец файла
+int host_log_csv_read(FILE *f, HostLogRec_t *Rec);
+
+// Запись Count записей двоичным логом
+// return 0 - записан, -1 - ошибка записи
+int host_log_write(FILE *f, const HostLogRec_t *Recs, uint32_t Count);
+
+#endif
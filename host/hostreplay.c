@@ -0,0 +1,80 @@
+// Прогон лога через экземпляр лямбда коррекции и LTFT
+
+#include <string.h>
+#include "host.h"
+#include "hostreplay.h"
+
+// Учет шага обучения: ltft_inst_control() меняет коррекцию канала
+// только когда переносит ее в таблицу
+static void host_replay_visit(HostReplay_t *Run, uint8_t Channel) {
+	Kosh_t *Kosh = Run->Kosh;
+	uint8_t y[4] = {Kosh->y1, Kosh->y2, Kosh->y2, Kosh->y1};
+	uint8_t x[4] = {Kosh->x1, Kosh->x1, Kosh->x2, Kosh->x2};
+
+	for (uint8_t i = 0; i < 4; i++) {
+		if (Kosh->CellsProp[i] >= HOST_VISIT_WEIGHT) {Run->Visits[Channel][y[i]][x[i]]++;}
+	}
+	Run->Steps++;
+}
+
+// Один такт: датчики такта, затем проход основного цикла
+static void host_replay_stroke(HostReplay_t *Run, const HostLogRec_t *Rec, uint32_t TimeMs) {
+	struct ecudata_t *ecu = Run->ecu;
+
+	ecu->sens.gas = Rec->Gas;
+	ecu->corr.afr = Rec->TargetAFR ? Rec->TargetAFR : lambda_inst_get_stoichval(Run->Ego);
+	ecu->ie_valve = Rec->FuelCut != 1;
+	ecu->fc_revlim = Rec->FuelCut == 2;
+	ecu->acceleration = Rec->Accel;
+	ecu->sens.inst_frq = Rec->RPM;
+	ecu->sens.inst_map = Rec->MAP;
+	ecu->sens.lambda[0] = Rec->EGO[0];
+	ecu->sens.lambda[1] = Rec->EGO[1];
+	ecu->sens.afr[0] = Rec->AFR[0];
+	ecu->sens.afr[1] = Rec->AFR[1];
+	lambda_inst_stroke_event_notification(Run->Ego);
+	ltft_inst_stroke_event_notification(Run->Kosh);
+
+	host_time = (uint16_t) (TimeMs / 10);
+	ecu->sens.map = ecu->sens.inst_map;
+	ecu->sens.map2 = Rec->MAP2;
+	ecu->sens.temperat = Rec->CLT;
+	ecu->sens.air_temp = Rec->IAT;
+	ecu->sens.carb = Rec->Carb;
+	lambda_inst_control(Run->Ego);
+
+	int16_t Lambda[2] = {ecu->corr.lambda[0], ecu->corr.lambda[1]};
+	ltft_inst_control(Run->Kosh);
+	for (uint8_t i = 0; i < 2; i++) {
+		if (ecu->corr.lambda[i] != Lambda[i]) {host_replay_visit(Run, i);}
+	}
+}
+
+void host_replay_run(HostReplay_t *Run, HostLogSrc_t *Src) {
+	HostLogRec_t Rec = {0};
+	HostLogRec_t Next = {0};
+	int Have = 0;
+	int n;
+	double StrokeTime = 0;
+
+	Run->Strokes = 0;
+	Run->Steps = 0;
+	Run->TimeMs = 0;
+	memset(Run->Visits, 0, sizeof(Run->Visits));
+
+	// Такты идут по оборотам текущей записи до времени следующей
+	while ((n = host_log_next(Src, &Next)) >= 0) {
+		if (!n) {continue;}
+		if (Have) {
+			while (Rec.RPM > 0 && StrokeTime < Next.Time) {
+				host_replay_stroke(Run, &Rec, (uint32_t) StrokeTime);
+				StrokeTime += 120000.0 / ((double) Rec.RPM * Run->Cylinders);
+				Run->Strokes++;
+			}
+		}
+		Rec = Next;
+		if (!Have || StrokeTime < Rec.Time) {StrokeTime = Rec.Time;}
+		Have = 1;
+		Run->TimeMs = Rec.Time;
+	}
+}
@@ -0,0 +1,35 @@
+// Прогон лога через экземпляр лямбда коррекции и LTFT (replay, calib)
+
+#ifndef _HOSTREPLAY_H_
+#define _HOSTREPLAY_H_
+
+#include <stdint.h>
+#include "hostlog.h"
+#include "lambda.h"
+#include "ltft.h"
+
+// Прогон одного лога. Экземпляры Ego и Kosh должны быть
+// инициализированы с данными ecu, остальные поля заполняет прогон.
+typedef struct {
+	struct ecudata_t *ecu;
+	lambda_state_t *Ego;
+	Kosh_t *Kosh;
+	int Cylinders;
+	uint32_t Strokes;			// Число тактов
+	uint32_t Steps;				// Число шагов обучения
+	uint32_t TimeMs;			// Время последней записи
+	// Шаги обучения по ячейкам каналов: шаг засчитывается ячейкам
+	// с весом не меньше HOST_VISIT_WEIGHT, как попадания KOSH_ADAPTIVE
+	uint32_t Visits[2][KOSH_GRID_LOAD][KOSH_GRID_RPM];
+} HostReplay_t;
+
+// Вес ячейки в шаге (x2048), с которого шаг засчитывается ячейке
+#define HOST_VISIT_WEIGHT 512
+
+// Прогон всех записей Src. Между записями генерируются такты по
+// оборотам из записи, на каждый такт вызываются те же функции и в том
+// же порядке, что и в прошивке. Таймер s_timer_gtc() потока ведется по
+// времени лога.
+void host_replay_run(HostReplay_t *Run, HostLogSrc_t *Src);
+
+#endif
@@ -0,0 +1,55 @@
+// Перевод текстового лога (CSV, поля - в начале replay.c) в двоичный
+// колоночный формат hostlog.h, который replay отображает в память.
+//
+// logconv лог.csv лог.bin
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hostlog.h"
+
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		fprintf(stderr, "usage: logconv log.csv log.bin\n");
+		return 2;
+	}
+
+	FILE *In = fopen(argv[1], "r");
+	if (!In) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	// Колонки пишутся после чтения всех записей
+	uint32_t Count = 0;
+	uint32_t Capacity = 0;
+	HostLogRec_t *Recs = NULL;
+	HostLogRec_t Rec;
+	int n;
+	while ((n = host_log_csv_read(In, &Rec)) >= 0) {
+		if (!n) {continue;}
+		if (Count == Capacity) {
+			Capacity = Capacity ? Capacity * 2 : 4096;
+			Recs = realloc(Recs, sizeof(HostLogRec_t) * Capacity);
+			if (!Recs) {
+				fprintf(stderr, "%s: out of memory\n", argv[1]);
+				return 1;
+			}
+		}
+		Recs[Count++] = Rec;
+	}
+	fclose(In);
+
+	FILE *Out = fopen(argv[2], "wb");
+	if (!Out) {
+		perror(argv[2]);
+		return 1;
+	}
+	if (host_log_write(Out, Recs, Count) || fclose(Out)) {
+		perror(argv[2]);
+		return 1;
+	}
+	free(Recs);
+
+	printf("%u records\n", Count);
+	return 0;
+}
@@ -0,0 +1,84 @@
+// Прогон лямбда коррекции и LTFT по записанному логу.
+//
+// Лог - двоичный (logconv, формат в hostlog.h), который отображается
+// в память, или текстовый файл, строка на запись, поля через запятую или ';':
+//	время мс, обороты, давление кПа, ОЖ °C, воздух °C,
+//	УДК1 В, УДК2 В, AFR1, AFR2, дроссель (0 - ХХ), газ (0/1),
+//	целевой AFR (0 - стехиометрия топлива), отсечка топлива (0 - нет,
+//	1 - принудительный ХХ, 2 - ограничитель оборотов), обогащение
+//	при ускорении (0/1), давление газа кПа
+// Поля в конце строки можно опустить, строки с # пропускаются.
+// Между записями генерируются такты по оборотам из записи, на каждый
+// такт вызываются те же функции и в том же порядке, что и в прошивке.
+//
+// replay [-n] [-c цилиндры] [-p параметры] [-v VE] [-l LTFT] лог
+//	-n	датчик - УДК (по умолчанию ШДК)
+//	-c	число цилиндров, тактов на оборот - половина (по умолчанию 4)
+//	-p	калибровка ЭБУ: сетки, задержка, пределы LTFT и параметры
+//		лямбда коррекции (формат - host_params_read() в host.c)
+//	-v	таблица VE (доли: 0.85), строки от меньшего давления
+//	-l	начальная таблица LTFT канала 1 в процентах, так же
+// Результат - таблицы LTFT обоих каналов в процентах.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "host.h"
+#include "hostreplay.h"
+#include "lambda.h"
+#include "ltft.h"
+
+static int replay_usage(void) {
+	fprintf(stderr, "usage: replay [-n] [-c cylinders] [-p params] [-v ve_table] [-l ltft_table] log\n");
+	return 2;
+}
+
+int main(int argc, char **argv) {
+	uint8_t Senstype = 1;
+	int Cylinders = 4;
+	const char *ParamsPath = NULL;
+	const char *VEPath = NULL;
+	const char *LTFTPath = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "nc:p:v:l:")) != -1) {
+		switch (opt) {
+			case 'n': Senstype = 0; break;
+			case 'c': Cylinders = atoi(optarg); break;
+			case 'p': ParamsPath = optarg; break;
+			case 'v': VEPath = optarg; break;
+			case 'l': LTFTPath = optarg; break;
+			default: return replay_usage();
+		}
+	}
+	if (optind != argc - 1 || Cylinders < 1) {return replay_usage();}
+
+	host_setup(Senstype);
+	if (ParamsPath && host_params_read(ParamsPath)) {return 1;}
+
+	if (VEPath && host_ve_load(VEPath)) {return 1;}
+	if (LTFTPath && host_ltft_load(LTFTPath, d.inj_ltft1)) {return 1;}
+
+	static lambda_state_t Ego;
+	static Kosh_t Kosh;
+	lambda_inst_init(&Ego, &d, &fw_data, NULL);
+	ltft_inst_init(&Kosh, &d, &fw_data, &Ego);
+
+	static HostLogSrc_t Src;
+	if (host_log_open(&Src, argv[optind])) {return 1;}
+	static HostReplay_t Run;
+	Run.ecu = &d;
+	Run.Ego = &Ego;
+	Run.Kosh = &Kosh;
+	Run.Cylinders = Cylinders;
+	clock_t Start = clock();
+	host_replay_run(&Run, &Src);
+	host_log_close(&Src);
+	double Elapsed = (double) (clock() - Start) / CLOCKS_PER_SEC;
+
+	printf("# %u strokes, %u learning steps, %.1f s of log, replayed in %.3f s\n", Run.Strokes, Run.Steps, Run.TimeMs / 1000.0, Elapsed);
+	host_ltft_print("# LTFT 1, %", d.inj_ltft1);
+	host_ltft_print("# LTFT 2, %", d.inj_ltft2);
+	return 0;
+}
@@ -0,0 +1,392 @@
+// Замкнутая модель двигателя для оценки скорости обучения LTFT.
+//
+// У модели есть "истинная" поверхность VE, таблица VE в ЭБУ задается
+// с ошибкой. Топливо считается по таблице VE ЭБУ с LTFT и лямбда
+// коррекцией, AFR в выпуске - по отношению истинного VE к этому.
+// До датчика AFR доходит с транспортной задержкой, зависящей от оборотов
+// и давления, датчик (ШДК или УДК) отвечает с инерцией. lambda.c и
+// ltft.c получают такты так же, как в прошивке.
+//
+// Для каждого сценария (ездовой цикл и тип датчика) выводится:
+//	converge - тактов до момента, после которого СКО ошибки VE по
+//	           пройденным ячейкам не выше допуска (-t)
+//	mean/max - остаточная ошибка ячеек в конце, %
+//	overshoot - наибольший переход ошибки ячейки через ноль, %
+//
+// sim [-e ошибка %] [-r разброс %] [-s тактов] [-t допуск %] [-c цикл] [-p]
+//	-e	ошибка таблицы VE ЭБУ во всех ячейках (по умолчанию 10)
+//	-r	случайный разброс ошибки по ячейкам ± (по умолчанию 5)
+//	-s	длина сценария в тактах (по умолчанию 400000)
+//	-t	допуск сходимости (по умолчанию 2.5)
+//	-c	только один ездовой цикл: steady, sweep, urban
+//	-p	вывести итоговую ошибку ячеек каждого сценария
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "host.h"
+#include "lambda.h"
+#include "ltft.h"
+
+#define SIM_CELLS (KOSH_GRID_LOAD * KOSH_GRID_RPM)
+// Число цилиндров, тактов на оборот - половина
+#define SIM_CYLINDERS 4
+// Шаг контрольных точек ошибки, тактов
+#define SIM_CHECK 1000
+// Наибольшая транспортная задержка, тактов
+#define SIM_DELAY_MAX 255
+// Вес ячейки (в тактах), начиная с которого она считается пройденной
+#define SIM_COVERED 300.0
+
+// Рабочая точка, заданная ездовым циклом
+typedef struct {
+	double RPM;
+	double MAP;						// кПа
+	int Idle;						// дроссель закрыт
+	int FuelCut;					// принудительный ХХ
+} SimPoint_t;
+
+typedef void (*SimCycle_t)(uint32_t Stroke, SimPoint_t *Point);
+
+static double ErrBase = 10;
+static double ErrSpread = 5;
+static uint32_t Strokes = 400000;
+static double Tol = 2.5;
+static int PrintCells;
+
+static uint32_t Seed;
+static double Err0[SIM_CELLS];		// Начальная ошибка VE ЭБУ по ячейкам, доли
+static double Cover[SIM_CELLS];		// Суммарный вес ячеек за сценарий
+static float *History;				// Ошибка ячеек по контрольным точкам, %
+
+static Kosh_t Kosh;
+static lambda_state_t Ego;
+
+static double sim_rand(void) {
+	Seed = Seed * 1103515245 + 12345;
+	return ((Seed >> 8) & 0xFFFF) / 65535.0;
+}
+
+static double sim_rpm_node(int x) {
+	return fw_data.exdata.rpm_grid_points[x];
+}
+
+static double sim_map_node(int y) {
+	return (d.param.load_lower + y * ((d.param.load_upper - d.param.load_lower) / (KOSH_GRID_LOAD - 1))) / 64.0;
+}
+
+// Транспортная задержка до датчика, тактов: постоянная часть
+// (такт выпуска) и время движения газов, большее на малой нагрузке
+static double sim_delay(double RPM, double MAP) {
+	double Ms = 30 + 60 * (100 - MAP) / 80;
+	return 4 + Ms * RPM * SIM_CYLINDERS / 120000;
+}
+
+// Ячейка и доли билинейной интерполяции по сетке ЭБУ
+static void sim_locate(double RPM, double MAP, int *x, int *y, double *fx, double *fy) {
+	int i = 0;
+	while (i < KOSH_GRID_RPM - 2 && RPM > sim_rpm_node(i + 1)) {i++;}
+	*x = i;
+	*fx = (RPM - sim_rpm_node(i)) / (sim_rpm_node(i + 1) - sim_rpm_node(i));
+	if (*fx < 0) {*fx = 0;}
+	if (*fx > 1) {*fx = 1;}
+
+	int j = 0;
+	while (j < KOSH_GRID_LOAD - 2 && MAP > sim_map_node(j + 1)) {j++;}
+	*y = j;
+	*fy = (MAP - sim_map_node(j)) / (sim_map_node(j + 1) - sim_map_node(j));
+	if (*fy < 0) {*fy = 0;}
+	if (*fy > 1) {*fy = 1;}
+}
+
+// VE ячейки ЭБУ с коррекцией LTFT
+static double sim_ecu_cell(int y, int x) {
+	return host_tables.inj_ve[y * KOSH_GRID_RPM + x] / 2048.0 * (1 + d.inj_ltft1[y][x] / 512.0);
+}
+
+// VE, по которому ЭБУ считает топливо: интерполяция ячеек с LTFT
+static double sim_ecu_ve(double RPM, double MAP) {
+	int x, y;
+	double fx, fy;
+	sim_locate(RPM, MAP, &x, &y, &fx, &fy);
+	return sim_ecu_cell(y, x) * (1 - fx) * (1 - fy) + sim_ecu_cell(y + 1, x) * (1 - fx) * fy
+		+ sim_ecu_cell(y + 1, x + 1) * fx * fy + sim_ecu_cell(y, x + 1) * fx * (1 - fy);
+}
+
+// "Истинное" VE в узлах сетки: максимум наполнения около 4000 об/мин,
+// рост с давлением. Между узлами - билинейная интерполяция, тогда
+// таблица ЭБУ может совпасть с ним точно и ошибка ячеек показывает
+// только работу алгоритма.
+static double sim_true_node(int y, int x) {
+	double r = (sim_rpm_node(x) - 4000) / 3000;
+	double MAP = sim_map_node(y);
+	return 0.55 + 0.30 * exp(-r * r) * (0.7 + 0.3 * MAP / 100) + 0.04 * sin(MAP / 12);
+}
+
+static double sim_true_ve(double RPM, double MAP) {
+	int x, y;
+	double fx, fy;
+	sim_locate(RPM, MAP, &x, &y, &fx, &fy);
+	return sim_true_node(y, x) * (1 - fx) * (1 - fy) + sim_true_node(y + 1, x) * (1 - fx) * fy
+		+ sim_true_node(y + 1, x + 1) * fx * fy + sim_true_node(y, x + 1) * fx * (1 - fy);
+}
+
+// Ошибка ячейки относительно истинного VE в узле, %
+static double sim_cell_error(int y, int x) {
+	return (sim_ecu_cell(y, x) / sim_true_node(y, x) - 1) * 100;
+}
+
+// Установившийся режим: точка держится 1500 тактов, переход 300 тактов
+static void cycle_steady(uint32_t Stroke, SimPoint_t *Point) {
+	static double From[2], To[2];
+	uint32_t Phase = Stroke % 1800;
+	if (!Stroke) {
+		To[0] = 2500;
+		To[1] = 60;
+	}
+	if (!Phase) {
+		From[0] = To[0];
+		From[1] = To[1];
+		To[0] = 1200 + sim_rand() * 3800;
+		To[1] = 30 + sim_rand() * 60;
+	}
+	double k = (Phase < 300) ? Phase / 300.0 : 1;
+	Point->RPM = From[0] + (To[0] - From[0]) * k;
+	Point->MAP = From[1] + (To[1] - From[1]) * k;
+}
+
+// Медленная развертка: обороты и давление ходят пилой с разными
+// периодами и обходят всю рабочую область
+static void cycle_sweep(uint32_t Stroke, SimPoint_t *Point) {
+	double a = fabs(fmod(Stroke / 20000.0, 2.0) - 1);
+	double b = fabs(fmod(Stroke / 7300.0, 2.0) - 1);
+	Point->RPM = 1200 + 4000 * a;
+	Point->MAP = 28 + 65 * b;
+}
+
+// Город: разгон, движение, торможение двигателем, ХХ
+static void cycle_urban(uint32_t Stroke, SimPoint_t *Point) {
+	static uint32_t End;
+	static int Mode;
+	static double Cruise[2];
+	if (!Stroke) {
+		End = 0;
+		Mode = 3;
+	}
+	if (Stroke >= End) {
+		Mode = (Mode + 1) % 4;
+		End = Stroke + 400 + (uint32_t) (sim_rand() * 2500);
+		Cruise[0] = 1500 + sim_rand() * 2200;
+		Cruise[1] = 35 + sim_rand() * 30;
+	}
+	double k = 1 - (End - Stroke) / 3000.0;
+	if (k < 0) {k = 0;}
+	switch (Mode) {
+		case 0:	// разгон
+			Point->RPM = 1800 + 3000 * k;
+			Point->MAP = 80 + 15 * sim_rand();
+			break;
+		case 1:	// движение
+			Point->RPM = Cruise[0];
+			Point->MAP = Cruise[1] + 3 * sim_rand();
+			break;
+		case 2:	// торможение двигателем
+			Point->RPM = 3000 - 1500 * k;
+			Point->MAP = 22;
+			Point->FuelCut = 1;
+			break;
+		default:	// ХХ
+			Point->RPM = 800 + 30 * sim_rand();
+			Point->MAP = 32 + 2 * sim_rand();
+			Point->Idle = 1;
+			break;
+	}
+}
+
+// Ошибка ячеек в контрольной точке n
+static void sim_checkpoint(uint32_t n) {
+	for (int y = 0; y < KOSH_GRID_LOAD; y++) {
+		for (int x = 0; x < KOSH_GRID_RPM; x++) {
+			History[n * SIM_CELLS + y * KOSH_GRID_RPM + x] = (float) sim_cell_error(y, x);
+		}
+	}
+}
+
+static void sim_run(const char *Name, SimCycle_t Cycle, uint8_t Senstype) {
+	host_setup(Senstype);
+	lambda_inst_init(&Ego, &d, &fw_data, &host_calib);
+	ltft_inst_init(&Kosh, &d, &fw_data, &Ego);
+	#ifdef KOSH_ADAPTIVE
+		// Таблицы LTFT пустые, счетчики попаданий им соответствуют
+		kosh_hits_reset(&Kosh, 0);
+		kosh_hits_reset(&Kosh, 1);
+	#endif
+
+	// Таблица задержек ЭБУ откалибрована по модели на 2500 об/мин
+	for (int i = 0; i < 16; i++) {
+		fw_data.exdata.inj_aftstr_strk1[i] = (uint8_t) lround(sim_delay(2500, 20 + i * 80 / 15.0));
+	}
+
+	// Таблица VE ЭБУ с ошибкой, одинаковой для всех сценариев
+	Seed = 1;
+	for (int y = 0; y < KOSH_GRID_LOAD; y++) {
+		for (int x = 0; x < KOSH_GRID_RPM; x++) {
+			int i = y * KOSH_GRID_RPM + x;
+			Err0[i] = (ErrBase + ErrSpread * (2 * sim_rand() - 1)) / 100;
+			host_tables.inj_ve[i] = (uint16_t) lround(sim_true_node(y, x) * (1 + Err0[i]) * 2048);
+			Cover[i] = 0;
+		}
+	}
+	Seed = 2;
+
+	static double AFR[SIM_DELAY_MAX + 1];
+	for (int i = 0; i <= SIM_DELAY_MAX; i++) {AFR[i] = 14.7;}
+	double Sensor = 14.7;
+	double MAP = 60;
+	double Time = 0;
+	uint32_t Checks = 0;
+
+	for (uint32_t s = 0; s < Strokes; s++) {
+		SimPoint_t Point = {0, 0, 0, 0};
+		Cycle(s, &Point);
+		// Давление во впуске догоняет заданное с инерцией
+		MAP += (Point.MAP - MAP) * 0.1;
+
+		// Смесь такта: воздух по истинному VE, топливо по ЭБУ
+		double Mix;
+		if (Point.FuelCut) {Mix = 25;}
+		else {
+			double Fuel = sim_ecu_ve(Point.RPM, MAP) * (1 + d.corr.lambda[0] / 512.0);
+			Mix = 14.7 * sim_true_ve(Point.RPM, MAP) / Fuel;
+		}
+		AFR[s & SIM_DELAY_MAX] = Mix;
+
+		// Датчик видит смесь с задержкой и отвечает с инерцией
+		double Delay = sim_delay(Point.RPM, MAP);
+		if (Delay > SIM_DELAY_MAX) {Delay = SIM_DELAY_MAX;}
+		Sensor += (AFR[(s - (uint32_t) Delay) & SIM_DELAY_MAX] - Sensor) * 0.5;
+		double Afr = Sensor > 20 ? 20 : Sensor;
+		double Volt = 0.45 + 0.4 * tanh((14.7 - Sensor) * 8);
+
+		// Такт
+		d.sens.inst_frq = (uint16_t) Point.RPM;
+		d.sens.inst_map = (uint16_t) (MAP * 64);
+		d.sens.afr[0] = (uint16_t) (Afr * 128);
+		d.sens.lambda[0] = (uint16_t) (Volt * 400);
+		d.ie_valve = !Point.FuelCut;
+		lambda_inst_stroke_event_notification(&Ego);
+		ltft_inst_stroke_event_notification(&Kosh);
+
+		// Проход основного цикла
+		Time += 120000.0 / (Point.RPM * SIM_CYLINDERS);
+		host_time = (uint16_t) (Time / 10);
+		d.sens.map = d.sens.inst_map;
+		d.sens.carb = !Point.Idle;
+		lambda_inst_control(&Ego);
+		ltft_inst_control(&Kosh);
+
+		// Пройденные ячейки
+		if (!Point.FuelCut) {
+			int x, y;
+			double fx, fy;
+			sim_locate(Point.RPM, MAP, &x, &y, &fx, &fy);
+			Cover[y * KOSH_GRID_RPM + x] += (1 - fx) * (1 - fy);
+			Cover[(y + 1) * KOSH_GRID_RPM + x] += (1 - fx) * fy;
+			Cover[(y + 1) * KOSH_GRID_RPM + x + 1] += fx * fy;
+			Cover[y * KOSH_GRID_RPM + x + 1] += fx * (1 - fy);
+		}
+
+		if (!(s % SIM_CHECK)) {sim_checkpoint(Checks++);}
+	}
+	sim_checkpoint(Checks++);
+
+	// Оценка по пройденным ячейкам: остаточная ошибка в конце
+	int Covered = 0;
+	double Mean = 0, Max = 0, Overshoot = 0;
+	for (int i = 0; i < SIM_CELLS; i++) {
+		if (Cover[i] < SIM_COVERED) {continue;}
+		double e = fabs(History[(Checks - 1) * SIM_CELLS + i]);
+		Covered++;
+		Mean += e;
+		if (e > Max) {Max = e;}
+	}
+	if (Covered) {Mean /= Covered;}
+
+	// Сходимость - первая контрольная точка, начиная с которой СКО
+	// не выше допуска, и переход ошибки через ноль за весь сценарий
+	int64_t Converge = -1;
+	for (uint32_t n = Checks; n-- > 0; ) {
+		double Sum = 0;
+		for (int i = 0; i < SIM_CELLS; i++) {
+			if (Cover[i] < SIM_COVERED) {continue;}
+			double e = History[n * SIM_CELLS + i];
+			Sum += e * e;
+			if (fabs(Err0[i]) >= 0.01) {
+				double Over = (Err0[i] > 0) ? -e : e;
+				if (Over > Overshoot) {Overshoot = Over;}
+			}
+		}
+		if (Converge == (int64_t) (n + 1) * SIM_CHECK || (n == Checks - 1)) {
+			if (Covered && sqrt(Sum / Covered) <= Tol) {Converge = (int64_t) n * SIM_CHECK;}
+		}
+	}
+
+	printf("%-8s %-4s %6d", Name, Senstype ? "WBO" : "NBO", Covered);
+	if (Converge >= 0) {printf(" %10lld", (long long) Converge);}
+	else {printf(" %10s", "never");}
+	printf(" %8.2f %8.2f %9.2f\n", Mean, Max, Overshoot);
+
+	if (PrintCells) {
+		for (int y = KOSH_GRID_LOAD - 1; y >= 0; y--) {
+			for (int x = 0; x < KOSH_GRID_RPM; x++) {
+				int i = y * KOSH_GRID_RPM + x;
+				if (Cover[i] < SIM_COVERED) {printf("     .");}
+				else {printf("%6.1f", History[(Checks - 1) * SIM_CELLS + i]);}
+			}
+			printf("\n");
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	static const struct {
+		const char *Name;
+		SimCycle_t Cycle;
+	} Cycles[] = {
+		{"steady", cycle_steady},
+		{"sweep", cycle_sweep},
+		{"urban", cycle_urban},
+	};
+	const char *Only = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "e:r:s:t:c:p")) != -1) {
+		switch (opt) {
+			case 'e': ErrBase = atof(optarg); break;
+			case 'r': ErrSpread = atof(optarg); break;
+			case 's': Strokes = strtoul(optarg, NULL, 0); break;
+			case 't': Tol = atof(optarg); break;
+			case 'c': Only = optarg; break;
+			case 'p': PrintCells = 1; break;
+			default:
+				fprintf(stderr, "usage: sim [-e err%%] [-r spread%%] [-s strokes] [-t tol%%] [-c cycle] [-p]\n");
+				return 2;
+		}
+	}
+	if (Strokes < SIM_CHECK) {Strokes = SIM_CHECK;}
+
+	History = malloc(sizeof(float) * SIM_CELLS * (Strokes / SIM_CHECK + 2));
+	if (!History) {return 1;}
+
+	printf("# VE error %.1f%% +-%.1f%%, %u strokes, tolerance %.1f%%\n", ErrBase, ErrSpread, Strokes, Tol);
+	printf("%-8s %-4s %6s %10s %8s %8s %9s\n", "cycle", "ego", "cells", "converge", "mean%", "max%", "overshoot");
+	for (size_t c = 0; c < sizeof(Cycles) / sizeof(Cycles[0]); c++) {
+		if (Only && strcmp(Only, Cycles[c].Name)) {continue;}
+		sim_run(Cycles[c].Name, Cycles[c].Cycle, 1);
+		sim_run(Cycles[c].Name, Cycles[c].Cycle, 0);
+	}
+	free(History);
+	return 0;
+}
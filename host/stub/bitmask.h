@@ -0,0 +1,7 @@
+/* Host stand-in for SECU-3 bitmask.h */
+#ifndef _BITMASK_H_
+#define _BITMASK_H_
+
+#define CHECKBIT(v,b) (((v) >> (b)) & 1)
+
+#endif
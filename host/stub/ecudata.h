@@ -0,0 +1,115 @@
+/* Host stand-in for SECU-3 ecudata.h and tables.h: only the fields used by
+   lambda.c and ltft.c. Units are the same as in the firmware: pressure x64,
+   temperature x4, voltage x400, AFR x128, corrections and LTFT x512, VE x2048. */
+#ifndef _ECUDATA_H_
+#define _ECUDATA_H_
+
+#include <stdint.h>
+
+#ifndef KOSH_GRID_RPM
+	#define KOSH_GRID_RPM 16
+#endif
+#ifndef KOSH_GRID_LOAD
+	#define KOSH_GRID_LOAD 16
+#endif
+
+/**Engine modes*/
+#define EM_START 0
+#define EM_IDLE  1
+#define EM_WORK  2
+
+/**Bits of params_t::func_flags*/
+#define FUNC_LDAX_GRID 3
+
+/**Bits of params_t::inj_lambda_flags*/
+#define LAMFLG_HTGDET  0
+#define LAMFLG_IDLCORR 1
+#define LAMFLG_MIXSEN  3
+
+/**Tables read through ecudata_t::mm_ptr12 (12-bit values, one per uint16_t on the host)*/
+struct f_data_t {
+	uint16_t inj_ve[KOSH_GRID_LOAD * KOSH_GRID_RPM];
+	uint16_t inj_ve2[KOSH_GRID_LOAD * KOSH_GRID_RPM];
+};
+
+/**Firmware data stored in flash*/
+struct exdata_t {
+	uint16_t rpm_grid_points[KOSH_GRID_RPM];
+	uint16_t rpm_grid_sizes[KOSH_GRID_RPM];
+	uint16_t load_grid_points[KOSH_GRID_LOAD];
+	uint16_t load_grid_sizes[KOSH_GRID_LOAD];
+	uint8_t inj_aftstr_strk1[16];
+	int8_t ltft_min;
+	int8_t ltft_max;
+	int16_t ltft_learn_clt;
+	uint16_t ltft_learn_gpa;
+	uint16_t ltft_learn_gpd;
+	uint8_t ltft_on_idling;
+	uint8_t ltft_mode;
+};
+
+struct fw_data_t {
+	struct exdata_t exdata;
+};
+
+typedef struct {
+	uint16_t inst_frq;
+	uint16_t inst_map;
+	uint16_t map;
+	uint16_t map2;
+	int16_t temperat;
+	int16_t air_temp;
+	uint16_t lambda[2];
+	uint16_t afr[2];
+	uint8_t gas;
+	uint8_t carb;
+} sensors_t;
+
+typedef struct {
+	int16_t lambda[2];
+	int16_t afr;
+} correct_t;
+
+typedef struct {
+	uint8_t func_flags;
+	uint16_t load_lower;
+	uint16_t load_upper;
+	uint8_t ve2_map_func;
+	uint8_t inj_lambda_senstype;
+	uint8_t inj_lambda_flags;
+	uint8_t lambda_selch;
+	uint8_t inj_lambda_activ_delay;
+	uint16_t inj_lambda_swt_point;
+	uint16_t inj_lambda_dead_band;
+	uint8_t inj_lambda_step_size_m;
+	uint8_t inj_lambda_step_size_p;
+	uint16_t inj_lambda_corr_limit_m;
+	uint16_t inj_lambda_corr_limit_p;
+	uint16_t gd_lambda_corr_limit_m;
+	uint16_t gd_lambda_corr_limit_p;
+	int16_t gd_lambda_stoichval;
+	uint16_t inj_lambda_rpm_thrd;
+	int16_t inj_lambda_temp_thrd;
+	uint8_t inj_lambda_str_per_stp;
+	uint16_t inj_lambda_ms_per_stp;
+	int16_t idlreg_turn_on_temp;
+} params_t;
+
+struct ecudata_t {
+	sensors_t sens;
+	correct_t corr;
+	params_t param;
+	uint16_t (*mm_ptr12)(uint16_t offset, uint16_t index);
+	int8_t inj_ltft1[KOSH_GRID_LOAD][KOSH_GRID_RPM];
+	int8_t inj_ltft2[KOSH_GRID_LOAD][KOSH_GRID_RPM];
+	uint8_t engine_mode;
+	uint8_t acceleration;
+	uint8_t ie_valve;
+	uint8_t fc_revlim;
+	uint8_t choke_pos;
+};
+
+extern struct ecudata_t d;
+extern struct fw_data_t fw_data;
+
+#endif
@@ -0,0 +1,13 @@
+/* Host stand-in for SECU-3 eeprom.h */
+#ifndef _EEPROM_H_
+#define _EEPROM_H_
+
+#include <stdint.h>
+
+#define OPCODE_RESET_LTFT 1
+#define OPCODE_SAVE_LTFT  2
+
+/**Pending EEPROM operation, set by host code in host_opcode*/
+uint8_t eeprom_get_pending_opcode(void);
+
+#endif
@@ -0,0 +1,18 @@
+/* Host stand-in for SECU-3 funconv.h */
+#ifndef _FUNCONV_H_
+#define _FUNCONV_H_
+
+#include <stdint.h>
+
+#define VE2MF_1ST 0
+#define VE2MF_MUL 1
+#define VE2MF_ADD 2
+
+/**Range of the WBO sensor curve (AFR x128)*/
+int16_t ego_curve_min(void);
+int16_t ego_curve_max(void);
+
+/**Lambda correction zone check, always allowed on the host*/
+uint8_t lambda_zone_val(void);
+
+#endif
@@ -0,0 +1,16 @@
+/* Host stand-in for SECU-3 ioconfig.h: I/O remapping is a bit mask in host_io */
+#ifndef _IOCONFIG_H_
+#define _IOCONFIG_H_
+
+#include <stdint.h>
+
+#define IOP_LAMBDA  0
+#define IOP_LAMBDA2 1
+#define IOP_GD_STP  2
+#define IOP_SM_STP  3
+
+#define IOCFG_CHECK(x) (io_check(x))
+
+uint8_t io_check(uint8_t iop);
+
+#endif
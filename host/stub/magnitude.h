@@ -0,0 +1,10 @@
+/* Host stand-in for SECU-3 magnitude.h */
+#ifndef _MAGNITUDE_H_
+#define _MAGNITUDE_H_
+
+#include <stdint.h>
+
+/**AFR value x128*/
+#define AFRVAL_MAG(x) ((int16_t)((x) * 128))
+
+#endif
@@ -0,0 +1,7 @@
+/* Host stand-in for SECU-3 mathemat.h: LTFT and lambda use fixmath.h instead */
+#ifndef _MATHEMAT_H_
+#define _MATHEMAT_H_
+
+#include <stdint.h>
+
+#endif
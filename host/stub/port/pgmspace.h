@@ -0,0 +1,11 @@
+/* Host stand-in for SECU-3 port/pgmspace.h: program memory is ordinary memory */
+#ifndef _PORT_PGMSPACE_H_
+#define _PORT_PGMSPACE_H_
+
+#include <stdint.h>
+
+#define PGM_GET_BYTE(p) (*(const uint8_t*)(p))
+#define PGM_GET_WORD(p) (*(const uint16_t*)(p))
+#define PGM_DECLARE(x) const x
+
+#endif
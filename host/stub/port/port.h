@@ -0,0 +1,7 @@
+/* Host stand-in for SECU-3 port/port.h: nothing platform specific is needed */
+#ifndef _PORT_PORT_H_
+#define _PORT_PORT_H_
+
+#include <stdint.h>
+
+#endif
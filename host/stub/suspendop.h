@@ -0,0 +1,5 @@
+/* Host stand-in for SECU-3 suspendop.h: not used on the host */
+#ifndef _SUSPENDOP_H_
+#define _SUSPENDOP_H_
+
+#endif
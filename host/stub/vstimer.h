@@ -0,0 +1,10 @@
+/* Host stand-in for SECU-3 vstimer.h: time is driven by host code in host_time */
+#ifndef _VSTIMER_H_
+#define _VSTIMER_H_
+
+#include <stdint.h>
+
+/**System timer, 10ms ticks*/
+uint16_t s_timer_gtc(void);
+
+#endif
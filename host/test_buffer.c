@@ -0,0 +1,103 @@
+// Нагрузочная проверка буфера тактов: писатель в своем потоке
+// добавляет такты без пауз (много быстрее, чем при 8000 об/мин),
+// читатель одновременно читает пары соседних ячеек kosh_buffer_read()
+// и сверяет скользящую сумму давления с ячейками. Каждая ячейка несет свой номер в оборотах и давлении,
+// поэтому видно и разорванную ячейку (обороты и давление из разных
+// записей), и потерянную или повторенную (соседние ячейки не подряд),
+// и сумму окна, не совпадающую с ячейками.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include "host.h"
+#include "ltft.h"
+
+// Период номера ячейки
+#define STRESS_PERIOD 200
+// Время проверки, с
+#define STRESS_TIME 1.0
+
+static Kosh_t Kosh;
+static volatile int Stop;
+static volatile uint32_t Pushes;
+
+// Значения ячейки номер n кратны шагу упаковки и сохраняются точно
+static uint16_t stress_rpm(uint32_t n) {return (n % STRESS_PERIOD + 10) * 32;}
+static uint16_t stress_map(uint32_t n) {return ((n * 37 + 11) % STRESS_PERIOD + 10) * 64;}
+
+// Номер ячейки по оборотам, -1 - давление не от той же записи
+static int stress_decode(uint16_t RPM, uint16_t MAP) {
+	int n = RPM / 32 - 10;
+	if (n < 0 || n >= STRESS_PERIOD || RPM % 32 || MAP != stress_map(n)) {return -1;}
+	return n;
+}
+
+static void *stress_writer(void *Arg) {
+	(void) Arg;
+	uint32_t n = KOSH_CBS;
+	while (!Stop) {
+		for (int i = 0; i < 4; i++) {kosh_circular_buffer_push(&Kosh, stress_rpm(n), stress_map(n));}
+		n++;
+		Pushes = n;
+	}
+	return NULL;
+}
+
+static double stress_now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(void) {
+	host_setup(1);
+	ltft_inst_init(&Kosh, &d, &fw_data, NULL);
+	for (uint32_t n = 0; n < KOSH_CBS; n++) {
+		for (int i = 0; i < 4; i++) {kosh_circular_buffer_push(&Kosh, stress_rpm(n), stress_map(n));}
+	}
+
+	pthread_t Writer;
+	if (pthread_create(&Writer, NULL, stress_writer, NULL)) {
+		printf("test_buffer: cannot start writer\n");
+		return 1;
+	}
+
+	long Reads = 0, Torn = 0, Lost = 0, Window = 0;
+	double Start = stress_now();
+	while (stress_now() - Start < STRESS_TIME) {
+		// Пары соседних ячеек через kosh_buffer_read()
+		for (uint8_t s = 0; s < KOSH_CBS - 1; s++) {
+			uint16_t RPM[2], MAP[2];
+			kosh_buffer_read(&Kosh, s, RPM, MAP);
+			int New = stress_decode(RPM[0], MAP[0]);
+			int Old = stress_decode(RPM[1], MAP[1]);
+			if (New < 0 || Old < 0) {Torn++;}
+			else if ((Old + 1) % STRESS_PERIOD != New) {Lost++;}
+			Reads++;
+		}
+
+		// Скользящая сумма против KOSH_WIN последних ячеек одной публикации
+		uint16_t Seq;
+		uint32_t Win, Sum;
+		do {
+			Seq = Kosh.BufferSeq;
+			__sync_synchronize();
+			Win = Kosh.BufferWinMAP;
+			Sum = 0;
+			uint8_t Index = Kosh.BufferIndex;
+			for (uint8_t s = 1; s <= KOSH_WIN; s++) {Sum += Kosh.BufferMAP[(Index + KOSH_CBS - s) % KOSH_CBS];}
+			__sync_synchronize();
+		} while ((Seq & 1) || Seq != Kosh.BufferSeq);
+		if (Win != Sum) {Window++;}
+	}
+	Stop = 1;
+	pthread_join(Writer, NULL);
+
+	// Тактов в секунду при 8000 об/мин, 8 цилиндров
+	double Rate = (Pushes - KOSH_CBS) * 4.0 / STRESS_TIME;
+	double Engine = 8000 / 60.0 * 4;
+	int Failed = Torn || Lost || Window || Reads < 1000;
+	printf("test_buffer: %ld reads, %.0f strokes/s (%.0fx 8000 rpm, 8 cyl), torn %ld, lost %ld, window %ld, %s\n",
+		Reads, Rate, Rate / Engine, Torn, Lost, Window, Failed ? "FAILED" : "ok");
+	return Failed ? 1 : 0;
+}
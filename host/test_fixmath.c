@@ -0,0 +1,118 @@
+// Проверка fixmath.h по эталонной арифметике в 64 битах.
+// Функции одного аргумента и сложение проверяются на всех значениях,
+// умножение - на всех значениях каждого аргумента при наборе значений
+// другого и всех сдвигах.
+
+#include <stdio.h>
+#include "fixmath.h"
+
+static long Failed;
+
+static void check(int Ok, const char *What, long long a, long long b, long long c, long long Got, long long Want) {
+	if (Ok) {return;}
+	if (++Failed <= 10) {
+		printf("FAIL %s(%lld, %lld, %lld) = %lld, want %lld\n", What, a, b, c, Got, Want);
+	}
+}
+
+static long long ref_sat(long long v, long long Lo, long long Hi) {
+	return v < Lo ? Lo : (v > Hi ? Hi : v);
+}
+
+// Сдвиг с округлением к нулю
+static long long ref_shift(long long p, int Shift) {
+	return p < 0 ? -((-p) >> Shift) : p >> Shift;
+}
+
+// Значения второго аргумента умножения: края, степени двойки и соседи, шаг
+static int samples(long long *Out, long long Lo, long long Hi) {
+	int n = 0;
+	for (long long v = Lo; v <= Hi; v += 509) {Out[n++] = v;}
+	for (int k = 0; k < 16; k++) {
+		long long p = 1LL << k;
+		long long Cand[6] = {p - 1, p, p + 1, -p - 1, -p, -p + 1};
+		for (int i = 0; i < 6; i++) {
+			if (Cand[i] >= Lo && Cand[i] <= Hi) {Out[n++] = Cand[i];}
+		}
+	}
+	Out[n++] = Lo;
+	Out[n++] = Hi;
+	return n;
+}
+
+int main(void) {
+	static long long S16[1024], U16[1024];
+	int NS = samples(S16, INT16_MIN, INT16_MAX);
+	int NU = samples(U16, 0, UINT16_MAX);
+
+	// Насыщение: весь диапазон вокруг границ и края int32
+	for (long long v = -(1LL << 18); v <= (1LL << 18); v++) {
+		check(fix_sat16(v) == ref_sat(v, INT16_MIN, INT16_MAX), "fix_sat16", v, 0, 0, fix_sat16(v), ref_sat(v, INT16_MIN, INT16_MAX));
+		if (v >= 0) {check(fix_usat16(v) == ref_sat(v, 0, UINT16_MAX), "fix_usat16", v, 0, 0, fix_usat16(v), ref_sat(v, 0, UINT16_MAX));}
+	}
+	for (int k = 18; k < 32; k++) {
+		long long v = (1LL << k);
+		check(fix_sat16(v - 1) == INT16_MAX && fix_sat16(-v) == INT16_MIN, "fix_sat16", v, 0, 0, fix_sat16(-v), INT16_MIN);
+		check(fix_usat16(v) == UINT16_MAX, "fix_usat16", v, 0, 0, fix_usat16(v), UINT16_MAX);
+	}
+	check(fix_usat16(UINT32_MAX) == UINT16_MAX, "fix_usat16", UINT32_MAX, 0, 0, fix_usat16(UINT32_MAX), UINT16_MAX);
+
+	// Модуль и ограничение: все значения
+	for (long long v = INT16_MIN; v <= INT16_MAX; v++) {
+		check(fix_abs16(v) == (v < 0 ? -v : v), "fix_abs16", v, 0, 0, fix_abs16(v), v < 0 ? -v : v);
+		for (int i = 0; i < NS; i += 7) {
+			long long Lo = S16[i] < 0 ? S16[i] : -S16[i];
+			long long Hi = -Lo - 1 < INT16_MAX ? -Lo - 1 : INT16_MAX;
+			if (Lo > Hi) {continue;}
+			check(fix_clamp16(v, Lo, Hi) == ref_sat(v, Lo, Hi), "fix_clamp16", v, Lo, Hi, fix_clamp16(v, Lo, Hi), ref_sat(v, Lo, Hi));
+		}
+	}
+
+	// Сложение: все пары
+	for (long long a = INT16_MIN; a <= INT16_MAX; a++) {
+		for (long long b = INT16_MIN; b <= INT16_MAX; b++) {
+			int16_t Got = fix_add_sat16(a, b);
+			if (Got != ref_sat(a + b, INT16_MIN, INT16_MAX)) {
+				check(0, "fix_add_sat16", a, b, 0, Got, ref_sat(a + b, INT16_MIN, INT16_MAX));
+			}
+		}
+	}
+
+	// Умножение со сдвигом
+	for (int Shift = 0; Shift <= 16; Shift++) {
+		for (long long a = INT16_MIN; a <= INT16_MAX; a++) {
+			for (int i = 0; i < NU; i++) {
+				long long b = U16[i];
+				if (Shift <= 15) {
+					long long Want = ref_shift(a * b, Shift);
+					int32_t Got = fix_mul_shift(a, b, Shift);
+					if (Got != Want) {check(0, "fix_mul_shift", a, b, Shift, Got, Want);}
+				}
+				if (a >= 0) {
+					long long Want = ref_sat((a * b) >> Shift, 0, UINT16_MAX);
+					uint16_t Got = fix_umul_shift(a, b, Shift);
+					if (Got != Want) {check(0, "fix_umul_shift", a, b, Shift, Got, Want);}
+				}
+			}
+		}
+		for (long long b = 0; b <= UINT16_MAX; b++) {
+			for (int i = 0; i < NS; i++) {
+				long long a = S16[i];
+				if (Shift <= 15) {
+					long long Want = ref_shift(a * b, Shift);
+					int32_t Got = fix_mul_shift(a, b, Shift);
+					if (Got != Want) {check(0, "fix_mul_shift", a, b, Shift, Got, Want);}
+				}
+			}
+			for (int i = 0; i < NU; i++) {
+				long long a = U16[i];
+				long long Want = ref_sat((a * b) >> Shift, 0, UINT16_MAX);
+				uint16_t Got = fix_umul_shift(a, b, Shift);
+				if (Got != Want) {check(0, "fix_umul_shift", a, b, Shift, Got, Want);}
+			}
+		}
+	}
+
+	printf("test_fixmath: %s\n", Failed ? "FAILED" : "ok");
+	return Failed ? 1 : 0;
+}
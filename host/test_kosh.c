@@ -0,0 +1,190 @@
+// Проверка деления kosh_udiv()/kosh_sdiv() по всем делителям, обратных
+// размеров ячеек, срока жизни сохраненных значений VE, калибровки
+// экземпляра, ожидания событий обучения, отложенной записи, запуска
+// сглаживания и шага штатного алгоритма в теневом режиме
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+#include "lambda.h"
+#include "ltft.h"
+
+static int Failed;
+
+static void check(int Ok, const char *What, long a, long b, long c, long Got, long Want) {
+	if (Ok) {return;}
+	if (++Failed <= 10) {
+		printf("FAIL %s(%ld, %ld, %ld) = %ld, want %ld\n", What, a, b, c, Got, Want);
+	}
+}
+
+int main(void) {
+	static const uint16_t Nums[] = {0, 1, 2, 3, 7, 64, 100, 255, 511, 512, 1000, 2047, 4095, 12345, 32767, 65535};
+	double Bias = 0;
+	long Count = 0;
+
+	for (uint8_t Scale = 0; Scale <= 11; Scale++) {
+		for (uint32_t Den = 1; Den <= 0xFFFF; Den++) {
+			for (size_t n = 0; n < sizeof(Nums) / sizeof(Nums[0]); n++) {
+				uint32_t Num = Nums[n];
+				uint64_t Full = (uint64_t) Num << Scale;
+				uint64_t Want = Full / Den;
+				if (Want > 0xFFFF) {Want = 0xFFFF;}
+				uint16_t Got = kosh_udiv(Num, Den, Scale);
+
+				// Не меньше точного и не больше чем на 1/4096 + 1
+				check(Got >= Want && Got <= Want + 1 + Want / 4096, "kosh_udiv", Num, Den, Scale, Got, Want);
+				// Точное деление с частным меньше 4096 и степени двойки - без ошибки
+				if ((Full % Den == 0 && Want < 4096) || !(Den & (Den - 1))) {
+					check(Got == Want, "kosh_udiv", Num, Den, Scale, Got, Want);
+				}
+				if (Want < 0xFFFF) {
+					Bias += (double) Got - Want;
+					Count++;
+				}
+			}
+		}
+	}
+
+	// Без смещения к нулю: среднее отличие от обычного деления
+	// неотрицательное и малое
+	Bias /= Count;
+	check(Bias >= 0 && Bias < 0.05, "bias", 0, 0, 0, (long) (Bias * 1000), 0);
+
+	for (int32_t Num = -32768; Num <= 32767; Num += 7) {
+		for (uint16_t Den = 1; Den < 2000; Den += 13) {
+			int32_t Want = Num / Den;
+			int16_t Got = kosh_sdiv(Num, Den, 0);
+			check(abs(Got - Want) <= 1 && (Got == 0 || (Got < 0) == (Num < 0)), "kosh_sdiv", Num, Den, 0, Got, Want);
+		}
+	}
+
+	check(kosh_udiv(64, 8, 0) == 8, "kosh_udiv", 64, 8, 0, kosh_udiv(64, 8, 0), 8);
+	check(kosh_udiv(100, 10, 0) == 10, "kosh_udiv", 100, 10, 0, kosh_udiv(100, 10, 0), 10);
+
+	// Доля ячейки по 16-битному обратному значению отличается от
+	// точного деления меньше чем на 1, если ячейки различаются
+	// по размеру не больше чем в 16 раз
+	static const uint16_t Axis[5] = {600, 700, 800, 2000, 2250};
+	uint16_t Recip[4];
+	uint8_t Shift = kosh_recip_update(Axis, Recip, 5);
+	for (int i = 0; i < 4; i++) {
+		uint16_t Size = Axis[i + 1] - Axis[i];
+		for (uint32_t dx = 0; dx < Size; dx++) {
+			long Got = ((uint32_t) dx * Recip[i]) >> Shift;
+			long Want = (dx * 2048) / Size;
+			check(Got <= Want && Got + 1 >= Want, "kosh_recip_update", i, dx, Shift, Got, Want);
+		}
+	}
+
+	// Правка VE в рабочей ячейке видна не позже KOSH_VE_CACHE_STEPS шагов
+	static Kosh_t Kosh;
+	host_setup(1);
+	ltft_inst_init(&Kosh, &d, &fw_data, NULL);
+	Kosh.y1 = Kosh.x1 = 3;
+	Kosh.y2 = Kosh.x2 = 4;
+	kosh_ve_fetch(&Kosh);
+	host_tables.inj_ve[3 * KOSH_GRID_RPM + 3] = 1000;
+	int Steps = 0;
+	while (Kosh.StartVE[0] != 1000 << 3 && Steps <= KOSH_VE_CACHE_STEPS) {
+		kosh_ve_fetch(&Kosh);
+		Steps++;
+	}
+	check(Steps <= KOSH_VE_CACHE_STEPS, "kosh_ve_fetch", 3, 3, 0, Steps, KOSH_VE_CACHE_STEPS);
+
+	// Сетки и пределы LTFT экземпляр берет из своей калибровки
+	static struct fw_data_t Fw;
+	Fw = fw_data;
+	Fw.exdata.ltft_max = 10;
+	Fw.exdata.rpm_grid_points[3] += 100;
+	ltft_inst_init(&Kosh, &d, &Fw, NULL);
+	kosh_axis_update(&Kosh);
+	int16_t Add = kosh_write_value(&Kosh, d.inj_ltft1, 3, 3, 50, 0);
+	check(Add == 10 && d.inj_ltft1[3][3] == 10, "fw ltft_max", 3, 3, 50, Add, 10);
+	check(Kosh.RPMAxis[3] == fw_data.exdata.rpm_grid_points[3] + 100, "fw rpm_grid", 3, 0, 0, Kosh.RPMAxis[3], fw_data.exdata.rpm_grid_points[3] + 100);
+
+	// Событие обучения ждет, пока не выполнятся условия обучения,
+	// и гасится, когда коррекция перенесена в таблицу
+	static lambda_state_t Ego;
+	host_setup(1);
+	lambda_inst_init(&Ego, &d, &fw_data, &host_calib);
+	ltft_inst_init(&Kosh, &d, &fw_data, &Ego);
+	for (int i = 0; i < KOSH_CBS * 4; i++) {kosh_circular_buffer_push(&Kosh, 2500, 60 * 64);}
+	d.corr.lambda[0] = 20;
+	Ego.learn_evt = 1;
+	d.sens.temperat = 20 * 4;
+	for (int i = 0; i < 100; i++) {ltft_inst_control(&Kosh);}
+	check(Ego.learn_evt == 1 && d.corr.lambda[0] == 20, "learn_evt cold", Ego.learn_evt, d.corr.lambda[0], 0, 0, 1);
+	d.sens.temperat = 90 * 4;
+	for (int i = 0; i < 100; i++) {
+		// Ячейка буфера тактов на проход, для отложенной записи
+		for (int j = 0; j < 4; j++) {kosh_circular_buffer_push(&Kosh, 2500, 60 * 64);}
+		ltft_inst_control(&Kosh);
+	}
+	long Sum = 0;
+	for (int y = 0; y < KOSH_GRID_LOAD; y++) {
+		for (int x = 0; x < KOSH_GRID_RPM; x++) {Sum += d.inj_ltft1[y][x];}
+	}
+	check(Ego.learn_evt == 0 && abs(d.corr.lambda[0]) < LAMBDA_LEARN_THRD && Sum > 0, "learn_evt warm", Ego.learn_evt, d.corr.lambda[0], Sum, 0, 0);
+
+	#ifdef KOSH_DEFERRED
+		// Отложенная запись делит коррекцию по ячейкам как сумма
+		// поотсчетных записей, а не по весам средней точки
+		host_setup(1);
+		ltft_inst_init(&Kosh, &d, &fw_data, NULL);
+		Kosh.y1 = Kosh.x1 = 3;
+		static const uint16_t AccProp[2][4] = {{2048, 0, 0, 0}, {0, 0, 2048, 0}};
+		static const int16_t AccLambda[2] = {20, 40};
+		for (int i = 0; i < 2; i++) {
+			for (int j = 0; j < 4; j++) {Kosh.CellsProp[j] = AccProp[i][j];}
+			d.corr.lambda[0] = AccLambda[i];
+			kosh_acc_add(&Kosh, 0);
+		}
+		kosh_acc_commit(&Kosh, 0);
+		check(Kosh.CellsProp[0] == 682 && Kosh.CellsProp[2] == 1366 && Kosh.Acc[0].Count == 0, "kosh_acc_commit", Kosh.CellsProp[0], Kosh.CellsProp[2], 0, Kosh.CellsProp[0], 682);
+	#endif
+
+	#ifdef KOSH_SMOOTH
+		// Сглаживание ждет восстановления счетчиков попаданий
+		host_setup(1);
+		ltft_inst_init(&Kosh, &d, &fw_data, NULL);
+		d.inj_ltft1[5][5] = 40;
+		Kosh.Hits[0][5][5] = 64;
+		for (int i = 0; i < 4; i++) {kosh_smooth_cell(&Kosh, 0, 5, 6);}
+		check(d.inj_ltft1[5][6] == 0, "smooth before load", 5, 6, 0, d.inj_ltft1[5][6], 0);
+		kosh_hits_loaded(&Kosh);
+		kosh_smooth_cell(&Kosh, 0, 5, 6);
+		check(d.inj_ltft1[5][6] == 10, "smooth after load", 5, 6, 0, d.inj_ltft1[5][6], 10);
+	#endif
+
+	#ifdef KOSH_SHADOW
+		// Пока активен штатный алгоритм, шаг ждет переключений зонда,
+		// а из коррекции снимается только записанное им в ячейку
+		host_setup(1);
+		lambda_inst_init(&Ego, &d, &fw_data, &host_calib);
+		ltft_inst_init(&Kosh, &d, &fw_data, &Ego);
+		kosh_shadow_select(&Kosh, 1);
+		uint16_t NodeRPM = fw_data.exdata.rpm_grid_points[6];
+		uint16_t NodeMAP = fw_data.exdata.load_grid_points[6];
+		for (int i = 0; i < KOSH_CBS * 4; i++) {kosh_circular_buffer_push(&Kosh, NodeRPM, NodeMAP);}
+		d.corr.lambda[0] = 20;
+		Ego.learn_evt = 1;
+		for (int i = 0; i < 10; i++) {
+			for (int j = 0; j < 4; j++) {kosh_circular_buffer_push(&Kosh, NodeRPM, NodeMAP);}
+			ltft_inst_control(&Kosh);
+		}
+		check(d.corr.lambda[0] == 20 && Kosh.Stat[KOSH_ALGO_KOSH].Steps == 0, "stock swt", d.corr.lambda[0], Kosh.Stat[KOSH_ALGO_KOSH].Steps, 0, 0, 20);
+
+		// При отложенной записи шаг делается, когда накопитель заполнится
+		Ego.swt_counter[0] = KOSH_STOCK_SWT;
+		for (int i = 0; i < 100 && Ego.swt_counter[0]; i++) {
+			for (int j = 0; j < 4; j++) {kosh_circular_buffer_push(&Kosh, NodeRPM, NodeMAP);}
+			ltft_inst_control(&Kosh);
+		}
+		int Cell = d.inj_ltft1[6][6];
+		check(Cell > 0 && d.corr.lambda[0] == 20 - Cell && Ego.swt_counter[0] == 0, "stock step", Cell, d.corr.lambda[0], Ego.swt_counter[0], 20 - Cell, 0);
+	#endif
+
+	printf("test_kosh: bias %.3f, %s\n", Bias, Failed ? "FAILED" : "ok");
+	return Failed ? 1 : 0;
+}
@@ -0,0 +1,77 @@
+// Проверка двоичного лога: запись, отображение в память и чтение
+// всех полей, разбор строки CSV и распознавание текстового лога
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hostlog.h"
+
+static int Failed;
+
+static void check(int Ok, const char *What, long i, long Got, long Want) {
+	if (Ok) {return;}
+	if (++Failed <= 10) {
+		printf("FAIL %s[%ld] = %ld, want %ld\n", What, i, Got, Want);
+	}
+}
+
+int main(void) {
+	enum {Count = 10007};
+	static HostLogRec_t Recs[Count];
+	srand(1);
+	for (uint32_t i = 0; i < Count; i++) {
+		HostLogRec_t *r = &Recs[i];
+		r->Time = i * 20 + (uint32_t) rand() % 7;
+		r->RPM = (uint16_t) rand();
+		r->MAP = (uint16_t) rand();
+		r->MAP2 = (uint16_t) rand();
+		r->EGO[0] = (uint16_t) rand();
+		r->EGO[1] = (uint16_t) rand();
+		r->AFR[0] = (uint16_t) rand();
+		r->AFR[1] = (uint16_t) rand();
+		r->CLT = (int16_t) rand();
+		r->IAT = (int16_t) rand();
+		r->TargetAFR = (int16_t) rand();
+		r->Carb = rand() & 1;
+		r->Gas = rand() & 1;
+		r->FuelCut = rand() % 3;
+		r->Accel = rand() & 1;
+	}
+
+	char Path[] = "/tmp/test_log_XXXXXX";
+	int fd = mkstemp(Path);
+	FILE *f = fdopen(fd, "wb");
+	check(f && !host_log_write(f, Recs, Count) && !fclose(f), "write", 0, 0, 0);
+
+	HostLog_t Log;
+	check(host_log_map(&Log, Path) == 0 && Log.Count == Count, "map", 0, Log.Count, Count);
+	for (uint32_t i = 0; i < Log.Count; i++) {
+		HostLogRec_t Rec;
+		host_log_get(&Log, i, &Rec);
+		#define TEST_LOG_FIELD(Type, Field) check(Rec.Field == Recs[i].Field, #Field, i, Rec.Field, Recs[i].Field);
+		HOST_LOG_COLUMNS(TEST_LOG_FIELD)
+		#undef TEST_LOG_FIELD
+	}
+	host_log_unmap(&Log);
+
+	// Текстовый лог: единицы прошивки и значения пропущенных полей
+	f = fopen(Path, "w");
+	fprintf(f, "# time,rpm,map\n1000, 2500, 60.5, 90, 30, 0.45, 0.5, 14.7, 13.2, 1, 0, 12.5, 2, 1, 150\n2000;800;30\n");
+	fclose(f);
+	check(host_log_map(&Log, Path) == 1, "csv detect", 0, 0, 1);
+	f = fopen(Path, "r");
+	HostLogRec_t Rec;
+	check(host_log_csv_read(f, &Rec) == 0, "csv header", 0, 0, 0);
+	check(host_log_csv_read(f, &Rec) == 1, "csv record", 1, 0, 1);
+	check(Rec.Time == 1000 && Rec.RPM == 2500 && Rec.MAP == 3872 && Rec.CLT == 360 && Rec.IAT == 120, "csv fields", 1, Rec.MAP, 3872);
+	check(Rec.EGO[0] == 180 && Rec.EGO[1] == 200 && Rec.AFR[0] == 1881 && Rec.AFR[1] == 1689, "csv ego", 1, Rec.AFR[0], 1881);
+	check(Rec.Carb == 1 && Rec.Gas == 0 && Rec.TargetAFR == 1600 && Rec.FuelCut == 2 && Rec.Accel == 1 && Rec.MAP2 == 9600, "csv tail", 1, Rec.MAP2, 9600);
+	check(host_log_csv_read(f, &Rec) == 1 && Rec.RPM == 800 && Rec.Carb == 1 && Rec.TargetAFR == 0 && Rec.FuelCut == 0, "csv short", 2, Rec.Carb, 1);
+	check(host_log_csv_read(f, &Rec) == -1, "csv end", 3, 0, -1);
+	fclose(f);
+	unlink(Path);
+
+	printf("test_log: %u records, %s\n", (unsigned) Count, Failed ? "FAILED" : "ok");
+	return Failed ? 1 : 0;
+}
@@ -28,12 +28,15 @@
 
 #include "port/port.h"
 #include <stdlib.h>
+#include <string.h>
 #include "bitmask.h"
 #include "ecudata.h"
 #include "funconv.h"
 #include "ioconfig.h"
+#include "lambda.h"
 #include "magnitude.h"
 #include "mathemat.h"
+#include "fixmath.h"
 #include "vstimer.h"
 
 // Время задержки после обогащения ускорения
@@ -41,51 +44,103 @@
 // Время задержки после отключения топлива
 #define EGO_FC_DELAY 250
 
-/**Internal state variables*/
-typedef struct {
-	uint8_t stroke_counter[2];      //!< Used to count strokes for correction integration
-	uint16_t lambda_t1;             //!< timer
-	uint16_t lambda_t2[2];          //!< timer for ms per step
-	uint8_t enabled[2];             //!< Flag indicates that lambda correction is enabled by timeout
-	uint8_t fc_delay[2];            //!< delay in strokes before lambda correction will be turned on after fuel cut off
-	uint8_t gasv_prev[2];           //!< previous value of GAS_V input
-	uint8_t ms_mask[2];             //!< correction mask (used for ms per step)
-	uint8_t last_sign[2];           //!< 0 - below, 1 - above
-	uint8_t swt_counter[2];         //!< counter of level switch
-} lambda_state_t;
-
-/**Instance of internal state variables structure*/
-static lambda_state_t ego = {{0},0,{0},{0},{0},{0},{0},{0},{0}};
+/**Instance of internal state variables structure used by firmware*/
+lambda_state_t lambda_state = {&d,&fw_data,NULL,{0},0,{0},{0},{0},{0},{0},{0},{0},0,0,{0},0,0,0};
 
-void lambda_control(void) {
-	if (d.engine_mode == EM_START && d.param.inj_lambda_activ_delay) {
-		ego.lambda_t1 = s_timer_gtc();
-		ego.enabled[0] = ego.enabled[1] = 0;
-		d.corr.lambda[0] = d.corr.lambda[1] = 0;
+void lambda_inst_config_update(lambda_state_t* ego) {
+	struct ecudata_t* ecu = ego->ecu;
+	uint8_t mixsen = CHECKBIT(ecu->param.inj_lambda_flags, LAMFLG_MIXSEN);
+
+	for (uint8_t i = 0; i < 2; ++i) {
+		uint8_t flags = 0;
+
+		if (mixsen) { //two sensors are blended into sensor #1
+			if (!IOCFG_CHECK(IOP_LAMBDA) && !IOCFG_CHECK(IOP_LAMBDA2)) {
+				flags |= LCF_SKIP;
+			}
+		}
+		else {
+			if (!IOCFG_CHECK(i ? IOP_LAMBDA2 : IOP_LAMBDA)) {
+				flags |= LCF_ZERO; //EGO is not enabled (input was not remapped)
+			}
+		}
+
+		if (0x00 == ecu->param.lambda_selch && 1 == i) {
+			flags |= LCF_ZERO; //2nd sensor is not selected for any cylinder
+		}
+
+		if (0xFF == ecu->param.lambda_selch && 0 == i && !mixsen) {
+			flags |= LCF_ZERO; //1st sensor is not selected for any cylinder
+		}
+
+		if (ecu->param.inj_lambda_senstype == 0) {
+			flags |= LCF_NBO;
+		}
+		else if (ecu->param.inj_lambda_senstype == 1) {
+			flags |= LCF_WBO;
+		}
+		if (CHECKBIT(ecu->param.inj_lambda_flags, LAMFLG_IDLCORR)) {
+			flags |= LCF_IDLCORR;
+		}
+		#ifdef GD_CONTROL
+			if (IOCFG_CHECK(IOP_GD_STP)) {
+				flags |= LCF_GDSTP;
+			}
+		#endif
+
+		ego->cfg_flags[i] = flags;
+	}
+
+	#if defined(FUEL_INJECT) || defined(GD_CONTROL)
+		if (ego->calib) {
+			ego->cfg_afr_min = ego->calib->curve_min(ego->fw);
+			ego->cfg_afr_max = ego->calib->curve_max(ego->fw);
+		}
+		else {
+			ego->cfg_afr_min = ego_curve_min();
+			ego->cfg_afr_max = ego_curve_max();
+		}
+	#endif
+
+	ego->cfg_t = s_timer_gtc();
+	ego->cfg_chnum = mixsen ? 1 : 2; //skip processing 2nd sensor if mixing is selected
+}
+
+void lambda_inst_control(lambda_state_t* ego) {
+	struct ecudata_t* ecu = ego->ecu;
+
+	if (!ego->cfg_chnum || ((uint16_t)(s_timer_gtc() - ego->cfg_t)) >= LAMBDA_CFG_PERIOD) {
+		lambda_inst_config_update(ego);
+	}
+
+	if (ecu->engine_mode == EM_START && ecu->param.inj_lambda_activ_delay) {
+		ego->lambda_t1 = s_timer_gtc();
+		ego->enabled[0] = ego->enabled[1] = 0;
+		ecu->corr.lambda[0] = ecu->corr.lambda[1] = 0;
 	}
 	else {
-		if ((s_timer_gtc() - ego.lambda_t1) >= (d.param.inj_lambda_activ_delay * 100)) {
+		if (((uint16_t)(s_timer_gtc() - ego->lambda_t1)) >= (ecu->param.inj_lambda_activ_delay * 100)) {
 			//deternime oxygen sensor's heating by monitoring voltage.
-			if (CHECKBIT(d.param.inj_lambda_flags, LAMFLG_HTGDET)) {
-				int16_t top_thrd = d.param.inj_lambda_swt_point + d.param.inj_lambda_dead_band;
-				int16_t bot_thrd = ((int16_t)d.param.inj_lambda_swt_point) - d.param.inj_lambda_dead_band;
+			if (CHECKBIT(ecu->param.inj_lambda_flags, LAMFLG_HTGDET)) {
+				int16_t top_thrd = ecu->param.inj_lambda_swt_point + ecu->param.inj_lambda_dead_band;
+				int16_t bot_thrd = ((int16_t)ecu->param.inj_lambda_swt_point) - ecu->param.inj_lambda_dead_band;
 				if (bot_thrd < 0) {
 					bot_thrd = 0;
 				}
 
-				if (d.sens.lambda[0] < bot_thrd || d.sens.lambda[0] > top_thrd) {
-					ego.enabled[0] = 1;
+				if (ecu->sens.lambda[0] < bot_thrd || ecu->sens.lambda[0] > top_thrd) {
+					ego->enabled[0] = 1;
 				}
-				if (!CHECKBIT(d.param.inj_lambda_flags, LAMFLG_MIXSEN)) {
-					if (d.sens.lambda[1] < bot_thrd || d.sens.lambda[1] > top_thrd) {
-						ego.enabled[1] = 1;
+				if (!CHECKBIT(ecu->param.inj_lambda_flags, LAMFLG_MIXSEN)) {
+					if (ecu->sens.lambda[1] < bot_thrd || ecu->sens.lambda[1] > top_thrd) {
+						ego->enabled[1] = 1;
 					}
 				}
 			}
 			else {
-				ego.enabled[0] = 1;
-				if (!CHECKBIT(d.param.inj_lambda_flags, LAMFLG_MIXSEN)) {
-					ego.enabled[1] = 1;
+				ego->enabled[0] = 1;
+				if (!CHECKBIT(ecu->param.inj_lambda_flags, LAMFLG_MIXSEN)) {
+					ego->enabled[1] = 1;
 				}
 			}
 		}
@@ -94,50 +149,53 @@ void lambda_control(void) {
 
 /** Process one lambda iteration
  * Uses d ECU data structure
+ * \param ego Pointer to state variables
  * \param mask Mask updating for "-" (1) or for "+" (2), 0 - no masking
  * \param inp Input selection: 0 - sensor #1, 1 - sensor #2
  * \return 1,2 - if correction has been updated (- or +), otherwise 0
  */
-static uint8_t lambda_iteration(uint8_t mask, uint8_t inp) {
+static uint8_t lambda_iteration(lambda_state_t* ego, uint8_t mask, uint8_t inp) {
+	struct ecudata_t* ecu = ego->ecu;
+
 	uint8_t updated = 0;
 	////////////////////////////////////////////////////////////////////////////////////////
-	if (d.param.inj_lambda_senstype == 0) { //NBO sensor type
+	if (ecu->param.inj_lambda_senstype == 0) { //NBO sensor type
 		//update EGO correction (with deadband)
-		int16_t int_m_thrd = d.param.inj_lambda_swt_point + d.param.inj_lambda_dead_band;
-		int16_t int_p_thrd = ((int16_t)d.param.inj_lambda_swt_point) - d.param.inj_lambda_dead_band;
+		int16_t int_m_thrd = ecu->param.inj_lambda_swt_point + ecu->param.inj_lambda_dead_band;
+		int16_t int_p_thrd = ((int16_t)ecu->param.inj_lambda_swt_point) - ecu->param.inj_lambda_dead_band;
 		if (int_p_thrd < 0) {int_p_thrd = 0;}
 
-		if (d.sens.lambda[inp] /*d.sens.inst_add_i1*/ > int_m_thrd) {
+		if (ecu->sens.lambda[inp] /*d.sens.inst_add_i1*/ > int_m_thrd) {
 			if (1 != mask) {
-				d.corr.lambda[inp] -= d.param.inj_lambda_step_size_m;
+				ecu->corr.lambda[inp] = fix_add_sat16(ecu->corr.lambda[inp], -ecu->param.inj_lambda_step_size_m);
 				updated = 1;
 				#ifdef FUEL_INJECT
 					//update switch counter
-					if (0 == ego.last_sign[inp]) {
-						++ego.swt_counter[inp];
+					if (0 == ego->last_sign[inp]) {
+						++ego->swt_counter[inp];
 					}
-					ego.last_sign[inp] = 1;
+					ego->last_sign[inp] = 1;
 				#endif
 			}
 		}
-		else if (d.sens.lambda[inp] /*d.sens.inst_add_i1*/ < int_p_thrd) {
+		else if (ecu->sens.lambda[inp] /*d.sens.inst_add_i1*/ < int_p_thrd) {
 			if (2 != mask) {
-				d.corr.lambda[inp] += d.param.inj_lambda_step_size_p;
+				ecu->corr.lambda[inp] = fix_add_sat16(ecu->corr.lambda[inp], ecu->param.inj_lambda_step_size_p);
 				updated = 2;
 				#ifdef FUEL_INJECT
 					//update switch counter
-					if (1 == ego.last_sign[inp]) {
-						++ego.swt_counter[inp];
+					if (1 == ego->last_sign[inp]) {
+						++ego->swt_counter[inp];
 					}
-					ego.last_sign[inp] = 0;
+					ego->last_sign[inp] = 0;
 				#endif
 			}
 		}
 	}
 	else { //WBO sensor type (or emulation)
 		#if defined(FUEL_INJECT) || defined(GD_CONTROL)
-			int16_t int_m_thrd = d.corr.afr - AFRVAL_MAG(0.05);
-			int16_t int_p_thrd = d.corr.afr + AFRVAL_MAG(0.05);
+			int16_t int_m_thrd = ecu->corr.afr - AFRVAL_MAG(0.05);
+			int16_t int_p_thrd = ecu->corr.afr + AFRVAL_MAG(0.05);
 		#else //CARB_AFR
 			int16_t int_m_thrd = AFRVAL_MAG(14.7) - AFRVAL_MAG(0.05);
 			int16_t int_p_thrd = AFRVAL_MAG(14.7) + AFRVAL_MAG(0.05);
@@ -145,29 +203,29 @@ static uint8_t lambda_iteration(uint8_t mask, uint8_t inp) {
 
 		if (int_m_thrd < 0) {int_m_thrd = 0;}
 
-		if (d.sens.afr[inp] < int_m_thrd) {
+		if (ecu->sens.afr[inp] < int_m_thrd) {
 			if (1 != mask) {
-				d.corr.lambda[inp] -= d.param.inj_lambda_step_size_m;
+				ecu->corr.lambda[inp] = fix_add_sat16(ecu->corr.lambda[inp], -ecu->param.inj_lambda_step_size_m);
 				updated = 1;
 				#ifdef FUEL_INJECT
 					//update switch counter
-					if (1 == ego.last_sign[inp]) {
-						++ego.swt_counter[inp];
+					if (1 == ego->last_sign[inp]) {
+						++ego->swt_counter[inp];
 					}
-					ego.last_sign[inp] = 0;
+					ego->last_sign[inp] = 0;
 				#endif
 			}
 		}
-		else if (d.sens.afr[inp] > int_p_thrd) {
+		else if (ecu->sens.afr[inp] > int_p_thrd) {
 			if (2 != mask) {
-				d.corr.lambda[inp] += d.param.inj_lambda_step_size_p;
+				ecu->corr.lambda[inp] = fix_add_sat16(ecu->corr.lambda[inp], ecu->param.inj_lambda_step_size_p);
 				updated = 2;
 				#ifdef FUEL_INJECT
 					//update switch counter
-					if (0 == ego.last_sign[inp]) {
-						++ego.swt_counter[inp];
+					if (0 == ego->last_sign[inp]) {
+						++ego->swt_counter[inp];
 					}
-					ego.last_sign[inp] = 1;
+					ego->last_sign[inp] = 1;
 				#endif
 			}
 		}
@@ -176,60 +234,75 @@ static uint8_t lambda_iteration(uint8_t mask, uint8_t inp) {
 
 	#ifdef GD_CONTROL
 		//Use special limits when (gas doser is active) AND ((choke control used AND choke not fully opened) OR (choke control isn't used AND engine is not heated))
-		if (d.sens.gas && IOCFG_CHECK(IOP_GD_STP) && ((IOCFG_CHECK(IOP_SM_STP) && (d.choke_pos > 0)) || (!IOCFG_CHECK(IOP_SM_STP) && d.sens.temperat <= d.param.idlreg_turn_on_temp))) {
-			restrict_value_to(&d.corr.lambda[inp], -d.param.gd_lambda_corr_limit_m, d.param.gd_lambda_corr_limit_p);
+		if (ecu->sens.gas && IOCFG_CHECK(IOP_GD_STP) && ((IOCFG_CHECK(IOP_SM_STP) && (ecu->choke_pos > 0)) || (!IOCFG_CHECK(IOP_SM_STP) && ecu->sens.temperat <= ecu->param.idlreg_turn_on_temp))) {
+			ecu->corr.lambda[inp] = fix_clamp16(ecu->corr.lambda[inp], -ecu->param.gd_lambda_corr_limit_m, ecu->param.gd_lambda_corr_limit_p);
 		}
 		else {
-			restrict_value_to(&d.corr.lambda[inp], -d.param.inj_lambda_corr_limit_m, d.param.inj_lambda_corr_limit_p);
+			ecu->corr.lambda[inp] = fix_clamp16(ecu->corr.lambda[inp], -ecu->param.inj_lambda_corr_limit_m, ecu->param.inj_lambda_corr_limit_p);
 		}
 	#else
-		restrict_value_to(&d.corr.lambda[inp], -d.param.inj_lambda_corr_limit_m, d.param.inj_lambda_corr_limit_p);
+		ecu->corr.lambda[inp] = fix_clamp16(ecu->corr.lambda[inp], -ecu->param.inj_lambda_corr_limit_m, ecu->param.inj_lambda_corr_limit_p);
+	#endif
+
+	#ifdef FUEL_INJECT
+		//notify LTFT that correction reached the learning threshold
+		if (updated && (ecu->corr.lambda[inp] >= LAMBDA_LEARN_THRD || ecu->corr.lambda[inp] <= -LAMBDA_LEARN_THRD)) {
+			ego->learn_evt |= (1 << inp);
+		}
 	#endif
 
 	return updated;
 }
 
 #if defined(FUEL_INJECT) || defined(GD_CONTROL)
+	/** Gets stoichiometric AFR value for current fuel
+	 * \param ecu Pointer to ECU data
+	 * \return AFR value * 128
+	 */
+	static int16_t lambda_stoichval(struct ecudata_t* ecu) {
+		return (ecu->sens.gas ? ecu->param.gd_lambda_stoichval : AFRVAL_MAG(14.7));
+	}
+
 	int16_t lambda_get_stoichval(void) {
-		return (d.sens.gas ? d.param.gd_lambda_stoichval : AFRVAL_MAG(14.7));
+		return lambda_stoichval(&d);
+	}
+
+	int16_t lambda_inst_get_stoichval(lambda_state_t* ego) {
+		return lambda_stoichval(ego->ecu);
 	}
 #endif
 
-void lambda_stroke_event_notification(void) {
-	//skip processing 2nd sensor if mixing is selected
-	uint8_t chnum = CHECKBIT(d.param.inj_lambda_flags, LAMFLG_MIXSEN) ? 1 : 2;
-	for (uint8_t i = 0; i < chnum; ++i) {
-		if (1 == chnum) { //two sensors are blended into sensor #1
-			d.corr.lambda[1] = 0;
-			if (!IOCFG_CHECK(IOP_LAMBDA) && !IOCFG_CHECK(IOP_LAMBDA2)) {
-				continue;
-			}
-		}
-		else {
-			if (!IOCFG_CHECK(i ? IOP_LAMBDA2 : IOP_LAMBDA)) {
-				d.corr.lambda[i] = 0;
-				continue; //EGO is not enabled (input was not remapped)
-			}
-		}
+void lambda_inst_stroke_event_notification(lambda_state_t* ego) {
+	struct ecudata_t* ecu = ego->ecu;
 
-		if (0x00 == d.param.lambda_selch && 1 == i) {
-			d.corr.lambda[1] = 0;
-			continue; //skip processing 2nd correction if 2nd sensor is not selected for any cylinder
-		}
+	if (!ego->cfg_chnum) {
+		lambda_inst_config_update(ego);
+	}
+
+	uint8_t chnum = ego->cfg_chnum;
+	if (1 == chnum) { //two sensors are blended into sensor #1
+		ecu->corr.lambda[1] = 0;
+	}
+
+	for (uint8_t i = 0; i < chnum; ++i) {
+		uint8_t flags = ego->cfg_flags[i];
 
-		if (0xFF==d.param.lambda_selch && 0 == i && !CHECKBIT(d.param.inj_lambda_flags, LAMFLG_MIXSEN))	{
-			d.corr.lambda[0] = 0;
-			continue; //skip processing 1st correction if 1st sensor is not selected for any cylinder
+		//input is not available or sensor is not selected for any cylinder
+		if (flags & (LCF_SKIP | LCF_ZERO)) {
+			if (flags & LCF_ZERO) {
+				ecu->corr.lambda[i] = 0;
+			}
+			continue;
 		}
 
-		if (!ego.enabled[i]) {
+		if (!ego->enabled[i]) {
 			continue; //wait some time before oxygen sensor will be turned on
 		}
 
 		//do not process EGO correction if it is not needed (gas equipment on the carburetor)
 		#if !defined(FUEL_INJECT) && !defined(CARB_AFR)
-			if (!d.sens.gas || !IOCFG_CHECK(IOP_GD_STP)) {
-				d.corr.lambda[i] = 0;
+			if (!ecu->sens.gas || !(flags & LCF_GDSTP)) {
+				ecu->corr.lambda[i] = 0;
 				continue;
 			}
 		#endif
@@ -238,33 +311,33 @@ void lambda_stroke_event_notification(void) {
 		#if defined(FUEL_INJECT) || defined(GD_CONTROL)
 
 			#if !defined(FUEL_INJECT) && defined(GD_CONTROL)
-				if ((d.sens.gas && IOCFG_CHECK(IOP_GD_STP))) {
+				if ((ecu->sens.gas && (flags & LCF_GDSTP))) {
 			#endif
 
 			//Turn off EGO correction on overrun or rev. limiting or on idling (if enabled)
 			// Отключение коррекции при нерабочем ШДК.
 			// Рабочий диапазон AFR 10.0 - 17.0 (x128).
-			if (d.param.inj_lambda_senstype == 1 && (d.sens.afr[i] < 1280 || d.sens.afr[i] > 2176)) {
-				ego.fc_delay[i] = EGO_FC_DELAY;
-				d.corr.lambda[i] = 0;
+			if ((flags & LCF_WBO) && (ecu->sens.afr[i] < 1280 || ecu->sens.afr[i] > 2176)) {
+				ego->fc_delay[i] = EGO_FC_DELAY;
+				ecu->corr.lambda[i] = 0;
 				continue;
 			}
 			// Время задержки при обогащении вынеc отдельно
-			if (d.acceleration && ego.fc_delay[i] < EGO_AC_DELAY) {
-				ego.fc_delay[i] = EGO_AC_DELAY;
-				d.corr.lambda[i] = 0;
+			if (ecu->acceleration && ego->fc_delay[i] < EGO_AC_DELAY) {
+				ego->fc_delay[i] = EGO_AC_DELAY;
+				ecu->corr.lambda[i] = 0;
 				continue;
 			}
 			//overrun or rev.limiting
-			if (!d.ie_valve || d.fc_revlim || (!d.sens.carb && !CHECKBIT(d.param.inj_lambda_flags, LAMFLG_IDLCORR))) {
-				ego.fc_delay[i] = EGO_FC_DELAY;
-				d.corr.lambda[i] = 0;
+			if (!ecu->ie_valve || ecu->fc_revlim || (!ecu->sens.carb && !(flags & LCF_IDLCORR))) {
+				ego->fc_delay[i] = EGO_FC_DELAY;
+				ecu->corr.lambda[i] = 0;
 				continue;
 			}
 			// Отматываем счетчик
-			if (ego.fc_delay[i]) {
-				--ego.fc_delay[i];
-				d.corr.lambda[i] = 0;
+			if (ego->fc_delay[i]) {
+				--ego->fc_delay[i];
+				ecu->corr.lambda[i] = 0;
 				continue;  //continue count delay
 			}
 
@@ -273,117 +346,170 @@ void lambda_stroke_event_notification(void) {
 			#endif
 
 			//used only by fuel injection and gas doser
-			if (d.param.inj_lambda_senstype == 0) { //NBO sensor type
-				int16_t afrerr = abs(d.corr.afr - lambda_get_stoichval());
+			if (flags & LCF_NBO) { //NBO sensor type
+				int16_t afrerr = abs(ecu->corr.afr - lambda_stoichval(ecu));
 
 				//EGO allowed only when AFR=14.7 for petrol, and 15.6 for LPG
 				if (afrerr > AFRVAL_MAG(0.05)) {
-					d.corr.lambda[i] = 0;
+					ecu->corr.lambda[i] = 0;
 					continue; //not a stoichiometry AFR
 				}
 			}
 			else { //WBO sensor type or emulation
-				if ((d.corr.afr < ego_curve_min()) || (d.corr.afr > ego_curve_max())) {
-					d.corr.lambda[i] = 0;
+				if ((ecu->corr.afr < ego->cfg_afr_min) || (ecu->corr.afr > ego->cfg_afr_max)) {
+					ecu->corr.lambda[i] = 0;
 					continue; //out of range
 				}
 			}
 
 			//Reset EGO correction if work point is out of set zone
-			if (!lambda_zone_val()) {
-				d.corr.lambda[i] = 0;
+			if (!(ego->calib ? ego->calib->zone_val(ecu, ego->fw) : lambda_zone_val())) {
+				ecu->corr.lambda[i] = 0;
 				continue; //not allowed for this (RPM,load)
 			}
 
 		#endif // FUEL_INJECT || GD_CONTROL
 
 		//Reset EGO correction each time fuel type(set of maps) is changed (triggering of level on the GAS_V input)
-		if (ego.gasv_prev[i] != d.sens.gas) {
-			d.corr.lambda[i] = 0;
-			ego.gasv_prev[i] = d.sens.gas;
+		if (ego->gasv_prev[i] != ecu->sens.gas) {
+			ecu->corr.lambda[i] = 0;
+			ego->gasv_prev[i] = ecu->sens.gas;
 			continue; //exit from this iteration
 		}
 
 		//RPM > threshold && coolant temperature > threshold
-		if ((d.sens.inst_frq > d.param.inj_lambda_rpm_thrd) && (d.sens.temperat > d.param.inj_lambda_temp_thrd)) {
-			if (d.param.inj_lambda_str_per_stp > 0) { //using strokes
-				if (ego.stroke_counter[i]) {
-					ego.stroke_counter[i]--;
+		if ((ecu->sens.inst_frq > ecu->param.inj_lambda_rpm_thrd) && (ecu->sens.temperat > ecu->param.inj_lambda_temp_thrd)) {
+			if (ecu->param.inj_lambda_str_per_stp > 0) { //using strokes
+				if (ego->stroke_counter[i]) {
+					ego->stroke_counter[i]--;
 				}
 				else {
-					ego.stroke_counter[i] = d.param.inj_lambda_str_per_stp;
-					lambda_iteration(0, i);
+					ego->stroke_counter[i] = ecu->param.inj_lambda_str_per_stp;
+					lambda_iteration(ego, 0, i);
 				}
 			}
 			else { //using ms
-				uint8_t updated = lambda_iteration(ego.ms_mask[i], i);
+				uint8_t updated = lambda_iteration(ego, ego->ms_mask[i], i);
 				if (updated) {
-					ego.lambda_t2[i] = s_timer_gtc();
-					ego.ms_mask[i] = updated;
+					ego->lambda_t2[i] = s_timer_gtc();
+					ego->ms_mask[i] = updated;
 				}
 				else {
-					if ((s_timer_gtc() - ego.lambda_t2[i]) >= (d.param.inj_lambda_ms_per_stp)) {
-						ego.ms_mask[i] = 0;
+					if (((uint16_t)(s_timer_gtc() - ego->lambda_t2[i])) >= (ecu->param.inj_lambda_ms_per_stp)) {
+						ego->ms_mask[i] = 0;
 					}
 				}
 			}
 		}
 		else {
-			d.corr.lambda[i] = 0;
+			ecu->corr.lambda[i] = 0;
 		}
 	}
 }
 
-uint8_t lambda_is_activated(uint8_t inp) {
+void lambda_inst_init(lambda_state_t* ego, struct ecudata_t* ecu, const struct fw_data_t* fw, const lambda_calib_t* calib) {
+	memset(ego, 0, sizeof(lambda_state_t));
+	ego->ecu = ecu;
+	ego->fw = fw;
+	ego->calib = calib;
+}
+
+uint8_t lambda_inst_is_activated(lambda_state_t* ego, uint8_t inp) {
+	struct ecudata_t* ecu = ego->ecu;
+
 	if (inp < 2) {
-		return ego.enabled[inp];
+		return ego->enabled[inp];
 	}
 	else {
-		if (CHECKBIT(d.param.inj_lambda_flags, LAMFLG_MIXSEN)) {
-			return ego.enabled[0]; //already mixed at sensor level
+		if (CHECKBIT(ecu->param.inj_lambda_flags, LAMFLG_MIXSEN)) {
+			return ego->enabled[0]; //already mixed at sensor level
 		}
 		if (IOCFG_CHECK(IOP_LAMBDA) && IOCFG_CHECK(IOP_LAMBDA2)) {
-			return ego.enabled[0] && ego.enabled[1];
+			return ego->enabled[0] && ego->enabled[1];
 		}
 		else if (IOCFG_CHECK(IOP_LAMBDA2)) {
-			return ego.enabled[1];
+			return ego->enabled[1];
 		}
 		else {
-			return ego.enabled[0];
+			return ego->enabled[0];
 		}
 	}
 }
 
+void lambda_inst_eng_stopped_notification(lambda_state_t* ego) {
+	struct ecudata_t* ecu = ego->ecu;
+
+	ecu->corr.lambda[0] = 0;
+	ecu->corr.lambda[1] = 0;
+}
+
+void lambda_control(void) {
+	lambda_inst_control(&lambda_state);
+}
+
+void lambda_stroke_event_notification(void) {
+	lambda_inst_stroke_event_notification(&lambda_state);
+}
+
+uint8_t lambda_is_activated(uint8_t inp) {
+	return lambda_inst_is_activated(&lambda_state, inp);
+}
+
 void lambda_eng_stopped_notification(void) {
-	d.corr.lambda[0] = 0;
-	d.corr.lambda[1] = 0;
+	lambda_inst_eng_stopped_notification(&lambda_state);
+}
+
+void lambda_config_update(void) {
+	lambda_inst_config_update(&lambda_state);
 }
 
 #ifdef FUEL_INJECT
+	uint8_t lambda_inst_get_learn_evt(lambda_state_t* ego) {
+		return ego->learn_evt;
+	}
+
+	void lambda_inst_clear_learn_evt(lambda_state_t* ego, uint8_t mask) {
+		ego->learn_evt &= ~mask;
+	}
+
+	void lambda_inst_reset_swt_counter(lambda_state_t* ego, uint8_t inp) {
+		ego->swt_counter[inp] = 0;
+	}
+
+	uint8_t lambda_inst_get_swt_counter(lambda_state_t* ego, uint8_t inp) {
+		return ego->swt_counter[inp];
+	}
+
 	void lambda_reset_swt_counter(uint8_t inp) {
-		ego.swt_counter[inp] = 0;
+		lambda_inst_reset_swt_counter(&lambda_state, inp);
 	}
 
 	uint8_t lambda_get_swt_counter(uint8_t inp) {
-		return ego.swt_counter[inp];
+		return lambda_inst_get_swt_counter(&lambda_state, inp);
 	}
 #endif
 
 #if defined(CARB_AFR) || defined(GD_CONTROL)
-	int16_t lambda_get_mixcor(void) {
-		if (CHECKBIT(d.param.inj_lambda_flags, LAMFLG_MIXSEN)) {
-			return d.corr.lambda[0]; //already mixed at sensor level
+	int16_t lambda_inst_get_mixcor(lambda_state_t* ego) {
+		struct ecudata_t* ecu = ego->ecu;
+
+		if (CHECKBIT(ecu->param.inj_lambda_flags, LAMFLG_MIXSEN)) {
+			return ecu->corr.lambda[0]; //already mixed at sensor level
 		}
 		if (IOCFG_CHECK(IOP_LAMBDA) && IOCFG_CHECK(IOP_LAMBDA2)) {
-			return (d.corr.lambda[0] + d.corr.lambda[1]) / 2;
+			return ((int32_t) ecu->corr.lambda[0] + ecu->corr.lambda[1]) / 2;
 		}
 		else if (IOCFG_CHECK(IOP_LAMBDA2)) {
-			return d.corr.lambda[1];
+			return ecu->corr.lambda[1];
 		}
 		else {
-			return d.corr.lambda[0];
+			return ecu->corr.lambda[0];
 		}
 	}
+
+	int16_t lambda_get_mixcor(void) {
+		return lambda_inst_get_mixcor(&lambda_state);
+	}
 #endif
 
 #endif
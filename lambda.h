@@ -29,6 +29,74 @@
 
 #if defined(FUEL_INJECT) || defined(CARB_AFR) || defined(GD_CONTROL)
 
+#include <stdint.h>
+
+struct ecudata_t;
+struct fw_data_t;
+
+/**Calibration functions of an instance. Functions of funconv.h used by
+ * the firmware's instance read the global d and fw_data, an instance with
+ * its own data supplies replacements taking that data explicitly */
+typedef struct {
+	int16_t (*curve_min)(const struct fw_data_t* fw);                         //!< replaces ego_curve_min()
+	int16_t (*curve_max)(const struct fw_data_t* fw);                         //!< replaces ego_curve_max()
+	uint8_t (*zone_val)(struct ecudata_t* ecu, const struct fw_data_t* fw);   //!< replaces lambda_zone_val()
+} lambda_calib_t;
+
+/**Internal state variables*/
+typedef struct {
+	struct ecudata_t* ecu;          //!< ECU data (inputs, parameters, corrections) used by this instance
+	const struct fw_data_t* fw;     //!< Calibration data in program memory used by this instance
+	const lambda_calib_t* calib;    //!< Calibration functions, NULL - functions of funconv.h (firmware's d and fw_data)
+	uint8_t stroke_counter[2];      //!< Used to count strokes for correction integration
+	uint16_t lambda_t1;             //!< timer
+	uint16_t lambda_t2[2];          //!< timer for ms per step
+	uint8_t enabled[2];             //!< Flag indicates that lambda correction is enabled by timeout
+	uint8_t fc_delay[2];            //!< delay in strokes before lambda correction will be turned on after fuel cut off
+	uint8_t gasv_prev[2];           //!< previous value of GAS_V input
+	uint8_t ms_mask[2];             //!< correction mask (used for ms per step)
+	uint8_t last_sign[2];           //!< 0 - below, 1 - above
+	uint8_t swt_counter[2];         //!< counter of level switch
+	uint8_t learn_evt;              //!< bit per sensor: correction reached LAMBDA_LEARN_THRD, pending until LTFT consumes it
+	uint8_t cfg_chnum;              //!< number of processed channels (1 - sensors are mixed), 0 - snapshot is not built yet
+	uint8_t cfg_flags[2];           //!< per channel flags compiled from parameters and I/O configuration (LCF_xxx)
+	int16_t cfg_afr_min;            //!< snapshot of ego_curve_min() or calib->curve_min()
+	int16_t cfg_afr_max;            //!< snapshot of ego_curve_max() or calib->curve_max()
+	uint16_t cfg_t;                 //!< timer of the last snapshot update
+} lambda_state_t;
+
+/**Per channel configuration flags (lambda_state_t::cfg_flags)*/
+#define LCF_SKIP    0x01            //!< channel is not processed, correction is kept
+#define LCF_ZERO    0x02            //!< channel is not processed, correction is reset
+#define LCF_NBO     0x04            //!< NBO sensor type
+#define LCF_WBO     0x08            //!< WBO sensor type (not emulation)
+#define LCF_IDLCORR 0x10            //!< correction is allowed on idling
+#define LCF_GDSTP   0x20            //!< gas doser stepper motor output is available
+
+/**Period (in 10ms ticks) of the configuration snapshot refresh from lambda_control()*/
+#define LAMBDA_CFG_PERIOD 50
+
+/**Instance of state variables used by firmware*/
+extern lambda_state_t lambda_state;
+
+/** Initialization of an independent instance of lambda correction
+ * \param ego Pointer to state variables
+ * \param ecu Pointer to ECU data used by this instance
+ * \param fw Pointer to calibration data used by this instance
+ * \param calib Calibration functions reading ecu and fw, NULL if they are the firmware's d and fw_data
+ */
+void lambda_inst_init(lambda_state_t* ego, struct ecudata_t* ecu, const struct fw_data_t* fw, const lambda_calib_t* calib);
+
+/** Instance versions of the functions below. Functions without the "inst"
+ * prefix work with the firmware's instance and d ECU data structure
+ * \param ego Pointer to state variables
+ */
+void lambda_inst_control(lambda_state_t* ego);
+void lambda_inst_config_update(lambda_state_t* ego);
+void lambda_inst_stroke_event_notification(lambda_state_t* ego);
+void lambda_inst_eng_stopped_notification(lambda_state_t* ego);
+uint8_t lambda_inst_is_activated(lambda_state_t* ego, uint8_t inp);
+
 /**Control of lambda correction
  * Uses d ECU data structure
  */
@@ -42,6 +110,12 @@ void lambda_stroke_event_notification(void);
 /**called from main loop when system detects engine stop*/
 void lambda_eng_stopped_notification(void);
 
+/** Rebuilds per channel configuration snapshot used by lambda_stroke_event_notification().
+ * Should be called when parameters have been changed, otherwise snapshot is refreshed
+ * by lambda_control() each LAMBDA_CFG_PERIOD
+ */
+void lambda_config_update(void);
+
 /** Check for activation of lambda sensor (heated-up)
  * \param inp 0 - check sensor #1, 1 - check sensor #2, 2 - check all available sensors
  * \return 1 - activated, 0 - still not activated
@@ -57,9 +131,39 @@ uint8_t lambda_is_activated(uint8_t inp);
  * \return AFR value * 128
  */
 int16_t lambda_get_stoichval(void);
+int16_t lambda_inst_get_stoichval(lambda_state_t* ego);
 #endif
 
 #ifdef FUEL_INJECT
+/**Absolute value of lambda correction (x512) starting from which LTFT learns*/
+#define LAMBDA_LEARN_THRD 3
+
+/** Gets pending learning events. An event stays pending until LTFT clears it,
+ * so a correction which reached the threshold is not lost while learning is not allowed
+ * \param ego Pointer to state variables
+ * \return bit 0 - sensor #1, bit 1 - sensor #2 reached LAMBDA_LEARN_THRD
+ */
+uint8_t lambda_inst_get_learn_evt(lambda_state_t* ego);
+
+/** Clears learning events: correction has been learned or dropped below the threshold
+ * \param ego Pointer to state variables
+ * \param mask bit 0 - sensor #1, bit 1 - sensor #2
+ */
+void lambda_inst_clear_learn_evt(lambda_state_t* ego, uint8_t mask);
+
+/** Reset counter of level switches
+ * \param ego Pointer to state variables
+ * \param inp 0 - sensor #1, 1 - sensor #2
+ */
+void lambda_inst_reset_swt_counter(lambda_state_t* ego, uint8_t inp);
+
+/** Get counter of level switches (for WBO - sign changes of the AFR error)
+ * \param ego Pointer to state variables
+ * \param inp 0 - sensor #1, 1 - sensor #2
+ * \return number of level switches since last call of lambda_inst_reset_swt_counter()
+ */
+uint8_t lambda_inst_get_swt_counter(lambda_state_t* ego, uint8_t inp);
+
 /** Reset counter of level switches*/
 void lambda_reset_swt_counter(uint8_t inp);
 
@@ -76,6 +180,7 @@ uint8_t lambda_get_swt_counter(uint8_t inp);
  * \return lambda correction
  */
 int16_t lambda_get_mixcor(void);
+int16_t lambda_inst_get_mixcor(lambda_state_t* ego);
 #endif
 
 #endif //_LAMBDA_H_
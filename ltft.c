@@ -28,6 +28,7 @@
 #include "port/port.h"
 #include "port/pgmspace.h"
 #include <stdlib.h>
+#include <string.h>
 #include "ltft.h"
 #include "ecudata.h"
 #include "eeprom.h"
@@ -35,180 +36,211 @@
 #include "funconv.h"
 #include "lambda.h"
 #include "mathemat.h"
+#include "fixmath.h"
 #include "bitmask.h"
 
-// Размер буфера
-#define KOSH_CBS 40
-
 // =============================================================================
 // ============ Костыль для коррекции ячеек с помощью интерполяции =============
 // =============================================================================
 
 // Вытащил эти макросы из funconv.c
 #define secu3_offsetof(type,member)   ((size_t)(&((type *)0)->member))
-#define _GWU12(x,i,j) (d.mm_ptr12(secu3_offsetof(struct f_data_t, x), (i*16+j) ))
-
-// Структура для хранения переменных
-typedef struct {
-	uint16_t RPM;					// Обороты x1
-	uint16_t MAP;					// Давление x64
-	uint16_t Kf;					// Коэффициент выравнивания x64
-	uint8_t x1;						// Координаты рабочих ячеек Обороты
-	uint8_t x2;						// -//-
-	uint8_t y1;						// Координаты рабочих ячеек Давление
-	uint8_t y2;						// -//-
-	uint16_t StartVE[4];			// Начальные значения VE x2048
-	uint16_t LTFTVE[4];				// Значения VE с текущей коррекцией LTFT x2048
-	uint16_t CalcVE;				// Интерполяция начальной VE x2048
-	uint16_t TargetVe;				// Целевое VE x2048
-	uint16_t CellsProp[4];			// Вес ячеек в коррекции x2048
-	int16_t VEAlignment[4];			// Добавка для выравнивания ячеек x2048
-	int16_t AddVE[4];				// Добавка к VE по коррекции x2048
-	int16_t LTFTAdd[4];				// Добавочный коэффициент LTFT x512
-	uint16_t BufferRPM[KOSH_CBS];	// Кольцевой буфер оборотов
-	uint16_t BufferMAP[KOSH_CBS];	// Кольцевой буфер давления
-	uint8_t BufferIndex;			// Текущая позиция буфера
-	uint8_t BufferAvg;				// Текущая позиция усреднения
-	uint32_t BufferSumRPM;			// Переменная для суммирования оборотов
-	uint32_t BufferSumMAP;			// Переменная для суммирования давления
-	uint8_t UseGrid;				// Использовать сетку давления
-	int16_t StepMAP;      			// Шаг сетки давления при использовании двух значений
-} Kosh_t;
-
-// Инициализация структуры
-Kosh_t Kosh = {
-				.RPM = 0,
-				.MAP = 0,
-				.Kf = 0,
-				.x1 = 0,
-				.x2 = 0,
-				.y1 = 0,
-				.y2 = 0,
-				.StartVE = {0},
-				.LTFTVE = {0},
-				.CalcVE = 0,
-				.TargetVe = 0,
-				.CellsProp = {0},
-				.VEAlignment = {0},
-				.AddVE = {0},
-				.LTFTAdd = {0},
-				.BufferRPM = {0},
-				.BufferMAP = {0},
-				.BufferIndex = 0,
-				.BufferAvg = 0,
-				.BufferSumRPM = 0,
-				.BufferSumMAP = 0,
-				.UseGrid = 0,
-				.StepMAP = 0
-	};
+#define _GWU12(e,x,i,j) ((e)->mm_ptr12(secu3_offsetof(struct f_data_t, x), ((i) * KOSH_GRID_RPM + (j)) ))
+
+// Обратные значения 2^15 / (1 + j / 64), j = 0..64, с округлением вверх для
+// делителя, нормализованного к диапазону 2^15..2^16. Начало каждого интервала
+// точное (степени двойки делятся без ошибки), внутри интервала значение
+// интерполируется линейно. Хорда выпуклой 1/x лежит выше нее, поэтому
+// результат не занижается, а завышение не больше 1/4096.
+PGM_DECLARE(uint16_t kosh_recip_table[65]) = {
+	32768, 32264, 31776, 31301, 30841, 30394, 29960, 29538,
+	29128, 28729, 28340, 27963, 27595, 27236, 26887, 26547,
+	26215, 25891, 25576, 25267, 24967, 24673, 24386, 24106,
+	23832, 23564, 23302, 23046, 22796, 22551, 22311, 22076,
+	21846, 21621, 21400, 21184, 20972, 20764, 20561, 20361,
+	20165, 19973, 19785, 19600, 19419, 19240, 19066, 18894,
+	18725, 18559, 18397, 18237, 18079, 17925, 17773, 17624,
+	17477, 17332, 17190, 17051, 16913, 16778, 16645, 16514,
+	16384
+};
+
+#ifdef KOSH_ADAPTIVE
+// График коэффициентов по ступеням числа попаданий в ячейку (Hits >> KOSH_HIT_SHIFT).
+// Коэффициент выравнивания x64, прежнее постоянное значение 26.
+PGM_DECLARE(uint8_t kosh_gain_kf[8]) = {40, 36, 32, 29, 26, 24, 22, 20};
+// Доля добавки по лямбде x64: свежая ячейка берет добавку целиком
+PGM_DECLARE(uint8_t kosh_gain_add[8]) = {64, 56, 48, 40, 34, 28, 24, 20};
+#endif
+
+// Экземпляр состояния, с которым работает прошивка
+static Kosh_t KoshMain = {.ecu = &d, .fw = &fw_data, .ego = &lambda_state};
+
+// Барьер памяти между записью буфера тактов и его публикацией.
+// В прошивке запись и чтение идут из основного цикла, достаточно
+// запрета перестановки обращений компилятором.
+#if defined(__GNUC__) && defined(__AVR__)
+	#define kosh_barrier() __asm__ __volatile__ ("" ::: "memory")
+#elif defined(__GNUC__)
+	#define kosh_barrier() __sync_synchronize()
+#else
+	#define kosh_barrier()
+#endif
+
+// Упаковка отсчета истории тактов с округлением и ограничением,
+// без KOSH_PACKED_HISTORY значения хранятся как есть
+#ifdef KOSH_PACKED_HISTORY
+	#define kosh_sample_pack(Value, Shift) \
+		((KoshSample_t) ((((uint32_t) (Value) + (1 << (Shift) >> 1)) >> (Shift)) > 255 ? 255 : \
+		(((uint32_t) (Value) + (1 << (Shift) >> 1)) >> (Shift))))
+#else
+	#define kosh_sample_pack(Value, Shift) ((KoshSample_t) (Value))
+#endif
+#define kosh_sample_unpack(Sample, Shift) ((uint16_t) (Sample) << (Shift))
+
+// Позиция буфера тактов на Back ячеек раньше Index (Back не больше KOSH_CBS)
+#if (KOSH_CBS & (KOSH_CBS - 1))
+	#define kosh_buffer_back(Index, Back) \
+		((uint8_t) ((Index) >= (Back) ? (Index) - (Back) : (Index) + KOSH_CBS - (Back)))
+#else
+	#define kosh_buffer_back(Index, Back) ((uint8_t) ((Index) - (Back)) & (KOSH_CBS - 1))
+#endif
+
+// Накоплена ли коррекция, достаточная для обучения
+#define kosh_lambda_ready(Lambda) ((Lambda) <= -LAMBDA_LEARN_THRD || (Lambda) >= LAMBDA_LEARN_THRD)
+
+// Таблицы LTFT нельзя менять: идет их сброс, а без поячеечного
+// сохранения - и запись таблиц в EEPROM целиком, иначе в EEPROM
+// попадет таблица, наполовину старая, наполовину новая
+static uint8_t kosh_tables_locked(void) {
+	uint8_t ee_opcode = eeprom_get_pending_opcode();
+	#ifdef KOSH_INCREMENTAL_SAVE
+		return ee_opcode == OPCODE_RESET_LTFT;
+	#else
+		return ee_opcode == OPCODE_RESET_LTFT || ee_opcode == OPCODE_SAVE_LTFT;
+	#endif
+}
 
 // Порядок нумерации ячеек в массивах
 //	1  2
 //	0  3
 
 // Расчет коррекции 
-void kosh_ltft_control(uint8_t Channel) {
+void kosh_ltft_control(Kosh_t *Kosh, uint8_t Channel) {
 	// Уходим, пока не накопится коррекция
-	if (d.corr.lambda[Channel] > -3 && d.corr.lambda[Channel] < 3) {return;}
+	if (!kosh_lambda_ready(Kosh->ecu->corr.lambda[Channel])) {return;}
+
+	if (!kosh_point_prepare(Kosh)) {return;}
+	kosh_channel_update(Kosh, Channel, Kosh->ecu->corr.lambda[Channel]);
+}
 
+// Первый этап: рабочая точка, ячейки, VE и вес ячеек.
+// Не зависит от канала, поэтому при двух датчиках выполняется один раз.
+// return 0 - точка не подходит для обучения
+uint8_t kosh_point_prepare(Kosh_t *Kosh) {
 	// Верхний порог по температуре на впуске 42 градуса x4
-	if (d.sens.air_temp > 168) {return;}
+	if (Kosh->ecu->sens.air_temp > 168) {return 0;}
+
+	// Сетки оборотов и давления
+	kosh_axis_update(Kosh);
 
 	// Находим целевые обороты и давления с учетом задержки
-	kosh_rpm_map_calc();
+	kosh_rpm_map_calc(Kosh);
 
 	// Пороги по оборотам и давлению (в основном для ХХ)
-	if (Kosh.RPM < 500 || Kosh.RPM > 6000) {return;}
-	if (Kosh.MAP < 10 * 64 || Kosh.MAP > 180 * 64) {return;}
+	if (Kosh->RPM < 500 || Kosh->RPM > 6000) {return 0;}
+	if (Kosh->MAP < 10 * 64 || Kosh->MAP > 180 * 64) {return 0;}
 
 	// Коэффициент выравнивания x64
-	Kosh.Kf = 26;
-
-	// Флаг использовать сетку давления
-	Kosh.UseGrid = CHECKBIT(d.param.func_flags, FUNC_LDAX_GRID);
-	if (!Kosh.UseGrid) {Kosh.StepMAP = (d.param.load_upper - d.param.load_lower) / 15;}
+	Kosh->Kf = 26;
 
 	// Поиск задействованных ячеек в расчете
-	kosh_find_cells();
-
-	// Извлечение значений из таблицы VE.
-	// Умножаем значение на 8 для большей точности.
-	// VE = VE1 (default)
-	if (d.param.ve2_map_func == VE2MF_1ST) {
-		Kosh.StartVE[0] = (_GWU12(inj_ve, Kosh.y1, Kosh.x1)) << 3;
-		Kosh.StartVE[1] = (_GWU12(inj_ve, Kosh.y2, Kosh.x1)) << 3;
-		Kosh.StartVE[2] = (_GWU12(inj_ve, Kosh.y2, Kosh.x2)) << 3;
-		Kosh.StartVE[3] = (_GWU12(inj_ve, Kosh.y1, Kosh.x2)) << 3;
-	}
-	// VE = VE1 * VE2
-	else if (d.param.ve2_map_func == VE2MF_MUL) {
-		Kosh.StartVE[0] = (((int32_t) _GWU12(inj_ve, Kosh.y1, Kosh.x1) * _GWU12(inj_ve2, Kosh.y1, Kosh.x1)) >> 11) << 3;
-		Kosh.StartVE[1] = (((int32_t) _GWU12(inj_ve, Kosh.y2, Kosh.x1) * _GWU12(inj_ve2, Kosh.y2, Kosh.x1)) >> 11) << 3;
-		Kosh.StartVE[2] = (((int32_t) _GWU12(inj_ve, Kosh.y2, Kosh.x2) * _GWU12(inj_ve2, Kosh.y2, Kosh.x2)) >> 11) << 3;
-		Kosh.StartVE[3] = (((int32_t) _GWU12(inj_ve, Kosh.y1, Kosh.x2) * _GWU12(inj_ve2, Kosh.y2, Kosh.x2)) >> 11) << 3;
-	}
-	// VE = VE1 + VE2
-	else if (d.param.ve2_map_func == VE2MF_ADD) {
-		Kosh.StartVE[0] = (_GWU12(inj_ve, Kosh.y1, Kosh.x1) + _GWU12(inj_ve2, Kosh.y1, Kosh.x1)) << 3;
-		Kosh.StartVE[1] = (_GWU12(inj_ve, Kosh.y2, Kosh.x1) + _GWU12(inj_ve2, Kosh.y2, Kosh.x1)) << 3;
-		Kosh.StartVE[2] = (_GWU12(inj_ve, Kosh.y2, Kosh.x2) + _GWU12(inj_ve2, Kosh.y2, Kosh.x2)) << 3;
-		Kosh.StartVE[3] = (_GWU12(inj_ve, Kosh.y1, Kosh.x2) + _GWU12(inj_ve2, Kosh.y2, Kosh.x2)) << 3;
-	}
-	// На всякий случай, дерьмо случается.
-	else {
-		return;
-	}
+	kosh_find_cells(Kosh);
 
-	// Вычисление значений с учетом имеющейся коррекции LTFT
-	if (Channel) {
-		Kosh.LTFTVE[0] = ((uint32_t) Kosh.StartVE[0] * (512 + d.inj_ltft2[Kosh.y1][Kosh.x1])) >> 9;
-		Kosh.LTFTVE[1] = ((uint32_t) Kosh.StartVE[1] * (512 + d.inj_ltft2[Kosh.y2][Kosh.x1])) >> 9;
-		Kosh.LTFTVE[2] = ((uint32_t) Kosh.StartVE[2] * (512 + d.inj_ltft2[Kosh.y2][Kosh.x2])) >> 9;
-		Kosh.LTFTVE[3] = ((uint32_t) Kosh.StartVE[3] * (512 + d.inj_ltft2[Kosh.y1][Kosh.x2])) >> 9;
-	}
-	else {
-		Kosh.LTFTVE[0] = ((uint32_t) Kosh.StartVE[0] * (512 + d.inj_ltft1[Kosh.y1][Kosh.x1])) >> 9;
-		Kosh.LTFTVE[1] = ((uint32_t) Kosh.StartVE[1] * (512 + d.inj_ltft1[Kosh.y2][Kosh.x1])) >> 9;
-		Kosh.LTFTVE[2] = ((uint32_t) Kosh.StartVE[2] * (512 + d.inj_ltft1[Kosh.y2][Kosh.x2])) >> 9;
-		Kosh.LTFTVE[3] = ((uint32_t) Kosh.StartVE[3] * (512 + d.inj_ltft1[Kosh.y1][Kosh.x2])) >> 9;
-	}
+	// Извлечение значений из таблицы VE
+	if (!kosh_ve_fetch(Kosh)) {return 0;}
 
 	// Расчет веса точек в коррекции
-	kosh_points_weight();
-
-	Kosh.CalcVE = bilinear_interpolation(Kosh.RPM, Kosh.MAP,
-					Kosh.LTFTVE[0],
-					Kosh.LTFTVE[1],
-					Kosh.LTFTVE[2],
-					Kosh.LTFTVE[3],
-					PGM_GET_WORD(&fw_data.exdata.rpm_grid_points[Kosh.x1]),
-					Kosh.UseGrid ? PGM_GET_WORD(&fw_data.exdata.load_grid_points[Kosh.y1]) : (Kosh.StepMAP * Kosh.y1 + d.param.load_lower),
-					PGM_GET_WORD(&fw_data.exdata.rpm_grid_sizes[Kosh.x1]),
-					Kosh.UseGrid ? PGM_GET_WORD(&fw_data.exdata.load_grid_sizes[Kosh.y1]) : (Kosh.StepMAP),
-					1);
+	kosh_points_weight(Kosh);
 
-	// Целевое VE 
-	Kosh.TargetVe = ((uint32_t) Kosh.CalcVE * (512 + d.corr.lambda[Channel])) >> 9;
-	Kosh.TargetVe += 1;
+	return 1;
+}
 
-	// Расчет добавки для выравнивания ячеек
-	int8_t Ng = 1;
-	for (uint8_t i = 0; i < 4; ++i) {
-		// Тут может быть отрицательное число, а сдвигать биты в этом случае
-		// это плохая идея, потому минус добавляем в конце.
-		Ng = 1;
-		Kosh.VEAlignment[i] = Kosh.TargetVe - Kosh.LTFTVE[i];
-		if (Kosh.VEAlignment[i] < 0) {
-			Ng = -1;
-			Kosh.VEAlignment[i] *= Ng;
+// Второй этап: коррекция таблицы LTFT канала по точке из kosh_point_prepare()
+// и лямбда коррекции Lambda
+void kosh_channel_update(Kosh_t *Kosh, uint8_t Channel, int16_t Lambda) {
+	struct ecudata_t* ecu = Kosh->ecu;
+
+	// Уходим, пока не накопится коррекция
+	if (!kosh_lambda_ready(Lambda)) {return;}
+
+	// Часть лямбда коррекции, которую снимает этот шаг
+	int16_t Taken = Lambda;
+
+	#ifdef KOSH_SHADOW
+		// Штатный алгоритм учится на той же точке и той же коррекции.
+		// Пока в таблицы ЭБУ пишет он, шаг делается только вместе с ним:
+		// коррекция снимается лишь на записанное им, и без этого теневая
+		// таблица училась бы на одной и той же коррекции каждый проход.
+		uint8_t StockStep = kosh_stock_ready(Kosh, Channel);
+		if (Kosh->StockActive && !StockStep) {return;}
+		if (StockStep) {
+			int16_t StockAdd = kosh_stock_update(Kosh, Channel, Lambda);
+			if (Kosh->StockActive) {Taken = StockAdd;}
 		}
-		Kosh.VEAlignment[i] = ((uint32_t) Kosh.VEAlignment[i] * Kosh.CellsProp[i]) >> 11;
-		Kosh.VEAlignment[i] = ((uint32_t) Kosh.VEAlignment[i] * Kosh.Kf) >> 6;
-		Kosh.VEAlignment[i] *= Ng;
+	#endif
+
+	// Промежуточные значения шага живут только на время вызова
+	KoshStep_t Step;
+
+	// Таблица LTFT, которую ведет этот алгоритм
+	KoshRow_t *Table = kosh_ltft_table(Kosh, Channel, 0);
+
+	// Вычисление значений с учетом имеющейся коррекции LTFT
+	Step.LTFTVE[0] = fix_umul_shift(Kosh->StartVE[0], 512 + Table[Kosh->y1][Kosh->x1], 9);
+	Step.LTFTVE[1] = fix_umul_shift(Kosh->StartVE[1], 512 + Table[Kosh->y2][Kosh->x1], 9);
+	Step.LTFTVE[2] = fix_umul_shift(Kosh->StartVE[2], 512 + Table[Kosh->y2][Kosh->x2], 9);
+	Step.LTFTVE[3] = fix_umul_shift(Kosh->StartVE[3], 512 + Table[Kosh->y1][Kosh->x2], 9);
+
+	// Коэффициенты выравнивания ячеек x64
+	uint8_t Kf[4];
+	#ifdef KOSH_ADAPTIVE
+		uint8_t Gain[4];
+		kosh_gain_schedule(Kosh, Channel, Kf, Gain);
+	#else
+		Kf[0] = Kf[1] = Kf[2] = Kf[3] = Kosh->Kf;
+	#endif
+
+	// Интерполяция по весам ячеек из kosh_points_weight()
+	Step.CalcVE = kosh_cells_dot(Kosh->CellsProp, Step.LTFTVE);
+
+	// Целевое VE 
+	Step.TargetVe = fix_umul_shift(Step.CalcVE, 512 + Lambda, 9);
+	Step.TargetVe += 1;
+
+	// Расчет добавки для выравнивания ячеек. Разница может быть
+	// отрицательной, fix_mul_shift() округляет к нулю, как и раньше,
+	// когда знак снимался перед сдвигом и возвращался после.
+	// Заодно копится интерполяция VE после выравнивания: веса в сумме
+	// дают 2048, поэтому она равна CalcVE плюс взвешенная добавка.
+	int32_t AlignSum = 0;
+	for (uint8_t i = 0; i < 4; ++i) {
+		int16_t Diff = fix_sat16((int32_t) Step.TargetVe - Step.LTFTVE[i]);
+		Diff = fix_sat16(fix_mul_shift(Diff, Kosh->CellsProp[i], 11));
+		Step.VEAlignment[i] = fix_sat16(fix_mul_shift(Diff, Kf[i], 6));
+		AlignSum += fix_mul_shift(Step.VEAlignment[i], Kosh->CellsProp[i], 0);
 	}
+	int32_t CalcVE2 = (int32_t) Step.CalcVE + AlignSum / 2048;
+	if (CalcVE2 < 0) {CalcVE2 = 0;}
 
 	// Расчет добавки по лямбде
-	kosh_add_ve_calculate(Channel);
+	kosh_add_ve_calculate(Kosh, &Step, Lambda, fix_usat16(CalcVE2));
+
+	#ifdef KOSH_ADAPTIVE
+		// Зрелые ячейки берут только часть добавки
+		for (uint8_t i = 0; i < 4; ++i) {
+			Step.AddVE[i] = fix_sat16(fix_mul_shift(Step.AddVE[i], Gain[i], 6));
+		}
+	#endif
 
 	// Итого мы имеем два массива значений VEAlignment и AddVE,
 	// которые необходимо добавить к VE.
@@ -219,203 +251,770 @@ void kosh_ltft_control(uint8_t Channel) {
 
 	// Расчет добавочного коэффициента LTFT
 	for (uint8_t i = 0; i < 4; ++i) {
-		Kosh.LTFTAdd[i] = (int32_t) (Kosh.VEAlignment[i] + Kosh.AddVE[i]) * 512 / Kosh.StartVE[i];
+		int16_t Delta = fix_add_sat16(Step.VEAlignment[i], Step.AddVE[i]);
+		Step.LTFTAdd[i] = kosh_sdiv(Delta, Kosh->StartVE[i], 9);
 	}
 
 	// Запись значений в таблицу LTFT
-	kosh_write_value(Kosh.y1, Kosh.x1, 0, Channel);
-	kosh_write_value(Kosh.y2, Kosh.x1, 1, Channel);
-	kosh_write_value(Kosh.y2, Kosh.x2, 2, Channel);
-	kosh_write_value(Kosh.y1, Kosh.x2, 3, Channel);
+	Step.LTFTAdd[0] = kosh_write_value(Kosh, Table, Kosh->y1, Kosh->x1, Step.LTFTAdd[0], Channel);
+	Step.LTFTAdd[1] = kosh_write_value(Kosh, Table, Kosh->y2, Kosh->x1, Step.LTFTAdd[1], Channel);
+	Step.LTFTAdd[2] = kosh_write_value(Kosh, Table, Kosh->y2, Kosh->x2, Step.LTFTAdd[2], Channel);
+	Step.LTFTAdd[3] = kosh_write_value(Kosh, Table, Kosh->y1, Kosh->x2, Step.LTFTAdd[3], Channel);
+
+	#ifdef KOSH_ADAPTIVE
+		kosh_hits_update(Kosh, Channel);
+	#endif
+
+	#ifdef KOSH_SHADOW
+		int16_t MaxAdd = 0;
+		for (uint8_t i = 0; i < 4; ++i) {
+			if (fix_abs16(Step.LTFTAdd[i]) > MaxAdd) {MaxAdd = fix_abs16(Step.LTFTAdd[i]);}
+		}
+		kosh_shadow_step(Kosh, KOSH_ALGO_KOSH, MaxAdd);
+	#endif
+
+	// Перенесенная в таблицу ЭБУ часть лямбда коррекции снимается. При записи
+	// сразу это вся коррекция, при отложенной - среднее накопленных
+	// отсчетов, разница с текущей коррекцией продолжает работать.
+	// Штатный алгоритм переносит только свою добавку к ячейке.
+	ecu->corr.lambda[Channel] = fix_add_sat16(ecu->corr.lambda[Channel], -Taken);
+}
+
+// Чтение VE одной ячейки, по функции на каждый режим VE2. Все функции
+// собираются одним макросом, поэтому обе таблицы читаются по одним и
+// тем же координатам. Умножаем значение на 8 для большей точности.
+#define KOSH_VE1 _GWU12(ecu, inj_ve, y, x)
+#define KOSH_VE2 _GWU12(ecu, inj_ve2, y, x)
+#define KOSH_VE_CELL(Name, Expr) \
+	static uint16_t Name(struct ecudata_t* ecu, uint8_t y, uint8_t x) { \
+		return (uint16_t)(Expr) << 3; \
+	}
+
+// VE = VE1 (default)
+KOSH_VE_CELL(kosh_ve_cell_1st, KOSH_VE1)
+// VE = VE1 * VE2
+KOSH_VE_CELL(kosh_ve_cell_mul, ((int32_t) KOSH_VE1 * KOSH_VE2) >> 11)
+// VE = VE1 + VE2
+KOSH_VE_CELL(kosh_ve_cell_add, KOSH_VE1 + KOSH_VE2)
+
+#undef KOSH_VE_CELL
+#undef KOSH_VE2
+#undef KOSH_VE1
+
+// Выбор функции чтения VE для режима VE2.
+// return NULL - неизвестный режим VE2
+KoshVECell_t kosh_ve_cell_select(uint8_t Mode) {
+	switch (Mode) {
+		case VE2MF_1ST: return kosh_ve_cell_1st;
+		case VE2MF_MUL: return kosh_ve_cell_mul;
+		case VE2MF_ADD: return kosh_ve_cell_add;
+		// На всякий случай, дерьмо случается.
+		default: return NULL;
+	}
+}
+
+// Извлечение значений из таблицы VE для рабочих ячеек.
+// Распакованные значения хранятся до смены ячеек, режима VE2 или набора
+// таблиц (бензин/газ), либо до сброса при изменении таблиц VE, но не
+// дольше KOSH_VE_CACHE_STEPS использований.
+// Функция чтения выбирается заново только при смене ключа.
+// return 0 - неизвестный режим VE2
+uint8_t kosh_ve_fetch(Kosh_t *Kosh) {
+	struct ecudata_t* ecu = Kosh->ecu;
+
+	uint8_t Key = 0x80 | (ecu->sens.gas << 4) | ecu->param.ve2_map_func;
+	if (Key != Kosh->VECacheKey) {
+		Kosh->VECacheKey = 0;
+		Kosh->VECell = kosh_ve_cell_select(ecu->param.ve2_map_func);
+		if (!Kosh->VECell) {return 0;}
+	}
+	else if (Kosh->y1 == Kosh->VECacheY && Kosh->x1 == Kosh->VECacheX && ++Kosh->VECacheAge < KOSH_VE_CACHE_STEPS) {return 1;}
+
+	Kosh->StartVE[0] = Kosh->VECell(ecu, Kosh->y1, Kosh->x1);
+	Kosh->StartVE[1] = Kosh->VECell(ecu, Kosh->y2, Kosh->x1);
+	Kosh->StartVE[2] = Kosh->VECell(ecu, Kosh->y2, Kosh->x2);
+	Kosh->StartVE[3] = Kosh->VECell(ecu, Kosh->y1, Kosh->x2);
+
+	Kosh->VECacheKey = Key;
+	Kosh->VECacheY = Kosh->y1;
+	Kosh->VECacheX = Kosh->x1;
+	Kosh->VECacheAge = 0;
+	return 1;
+}
+
+void kosh_ve_cache_invalidate(Kosh_t *Kosh) {
+	Kosh->VECacheKey = 0;
+}
+
+#ifdef KOSH_DEFERRED
+// Накопление отсчета для отложенной записи. Пока точка остается в тех же
+// ячейках, по каждой ячейке копятся ее доля и доля, умноженная на лямбда
+// коррекцию: веса билинейной интерполяции нелинейны по точке, поэтому
+// запись по средней точке дала бы ячейкам не ту коррекцию.
+void kosh_acc_add(Kosh_t *Kosh, uint8_t Channel) {
+	KoshAcc_t *Acc = &Kosh->Acc[Channel];
+	int16_t Lambda = Kosh->ecu->corr.lambda[Channel];
+
+	if (!kosh_lambda_ready(Lambda) || Acc->Full) {return;}
+
+	// Точка ушла в другие ячейки, накопленное отправляем на запись
+	if (Acc->Count && (Acc->y1 != Kosh->y1 || Acc->x1 != Kosh->x1)) {
+		Acc->Full = 1;
+		return;
+	}
+
+	Acc->y1 = Kosh->y1;
+	Acc->x1 = Kosh->x1;
+	for (uint8_t i = 0; i < 4; ++i) {
+		Acc->SumProp[i] += Kosh->CellsProp[i];
+		Acc->SumPropLambda[i] += (int32_t) Kosh->CellsProp[i] * Lambda;
+	}
+	Acc->Count++;
+	if (Acc->Count >= KOSH_ACC_COUNT) {Acc->Full = 1;}
+}
+
+// Отложенная запись: полный расчет коррекции один раз на накопленные
+// отсчеты. Лямбда коррекция - среднее по отсчетам (доли каждого отсчета
+// в сумме 2048), доля ячейки - ее часть в накопленной коррекции, так что
+// ячейка получает сумму своих поотсчетных поправок. Если знак коррекции
+// по ячейкам разный, берутся средние доли. Из лямбда коррекции снимается
+// только записанное среднее.
+void kosh_acc_commit(Kosh_t *Kosh, uint8_t Channel) {
+	KoshAcc_t *Acc = &Kosh->Acc[Channel];
+	uint8_t Count = Acc->Count;
+
+	Acc->Full = 0;
+	Acc->Count = 0;
+	if (!Count) {
+		memset(Acc, 0, sizeof(KoshAcc_t));
+		return;
+	}
+
+	int32_t Total = 0;
+	uint8_t Mixed = 0;
+	for (uint8_t i = 0; i < 4; ++i) {Total += Acc->SumPropLambda[i];}
+	for (uint8_t i = 0; i < 4; ++i) {
+		if (Acc->SumPropLambda[i] && (Acc->SumPropLambda[i] < 0) != (Total < 0)) {Mixed = 1;}
+	}
+	int16_t Lambda = Total / ((int32_t) Count << 11);
+
+	// Модули сумм ужимаются, чтобы произведение на 2048 влезло в 32 бита
+	uint32_t Abs[4];
+	uint32_t AbsTotal = 0;
+	for (uint8_t i = 0; i < 4; ++i) {
+		Abs[i] = Acc->SumPropLambda[i] < 0 ? -Acc->SumPropLambda[i] : Acc->SumPropLambda[i];
+		AbsTotal += Abs[i];
+	}
+	uint8_t Shift = 0;
+	while ((AbsTotal >> Shift) >= (1UL << 20)) {Shift++;}
+	AbsTotal >>= Shift;
 
-	// Обнуление лямбда коррекции
-	d.corr.lambda[Channel] = 0;
+	// Доля ячейки 2 - дополнение до 2048, как в kosh_points_weight()
+	uint16_t Rest = 2048;
+	for (uint8_t i = 0; i < 4; ++i) {
+		if (i == 2) {continue;}
+		if (Mixed || !AbsTotal) {
+			Kosh->CellsProp[i] = Acc->SumProp[i] / Count;
+		} else {
+			Kosh->CellsProp[i] = ((Abs[i] >> Shift) << 11) / AbsTotal;
+		}
+		Rest -= Kosh->CellsProp[i];
+	}
+	Kosh->CellsProp[2] = Rest;
+
+	Kosh->y1 = Acc->y1;
+	Kosh->x1 = Acc->x1;
+	Kosh->y2 = Acc->y1 + 1;
+	Kosh->x2 = Acc->x1 + 1;
+	memset(Acc, 0, sizeof(KoshAcc_t));
+
+	if (!kosh_ve_fetch(Kosh)) {return;}
+	kosh_channel_update(Kosh, Channel, Lambda);
 }
+#endif
+
+// Таблица LTFT канала, которую ведет алгоритм: Stock = 0 - двойной
+// интерполяции, 1 - штатный. Без теневого режима есть только таблицы ЭБУ.
+KoshRow_t *kosh_ltft_table(Kosh_t *Kosh, uint8_t Channel, uint8_t Stock) {
+	struct ecudata_t* ecu = Kosh->ecu;
 
-void kosh_write_value(uint8_t y, uint8_t x, uint8_t n, uint8_t Channel) {
+	#ifdef KOSH_SHADOW
+		if (Stock != Kosh->StockActive) {return Kosh->Shadow[Channel];}
+	#else
+		(void) Stock;
+	#endif
+	return Channel ? ecu->inj_ltft2 : ecu->inj_ltft1;
+}
+
+// Добавление коррекции Add к ячейке (y, x) таблицы Table канала Channel.
+// return добавка после ограничения ltft_min...ltft_max
+int16_t kosh_write_value(Kosh_t *Kosh, KoshRow_t *Table, uint8_t y, uint8_t x, int16_t Add, uint8_t Channel) {
 	// // Ограничение значения коррекции
-	int8_t Value = Channel ? d.inj_ltft2[y][x] : d.inj_ltft1[y][x];
-	int8_t Min = PGM_GET_BYTE(&fw_data.exdata.ltft_min);
-	int8_t Max = PGM_GET_BYTE(&fw_data.exdata.ltft_max);
+	int8_t Value = Table[y][x];
+	int8_t Min = PGM_GET_BYTE(&Kosh->fw->exdata.ltft_min);
+	int8_t Max = PGM_GET_BYTE(&Kosh->fw->exdata.ltft_max);
 
-	if (Value + Kosh.LTFTAdd[n] > Max) {Kosh.LTFTAdd[n] = Max - Value;}
-	else if (Value + Kosh.LTFTAdd[n] < Min) {Kosh.LTFTAdd[n] = Min - Value;}
+	Add = fix_clamp16(fix_add_sat16(Value, Add), Min, Max) - Value;
+
+	if (!Add) {return 0;}
 
 	// Добавляем коррекцию в таблицу LTFT (Давление / Обороты)
-	if (Channel) {d.inj_ltft2[y][x] += Kosh.LTFTAdd[n];}
-	else 		 {d.inj_ltft1[y][x] += Kosh.LTFTAdd[n];}
+	Table[y][x] += Add;
+
+	#ifdef KOSH_INCREMENTAL_SAVE
+		// Ячейка таблицы ЭБУ изменилась, ее нужно сохранить в EEPROM.
+		// Теневые таблицы не сохраняются.
+		#ifdef KOSH_SHADOW
+			if (Table == Kosh->Shadow[Channel]) {return Add;}
+		#endif
+		Kosh->Dirty[Channel][y] |= ((KoshDirty_t) 1 << x);
+	#else
+		(void) Channel;
+	#endif
+	return Add;
+}
+
+#ifdef KOSH_ADAPTIVE
+// Коэффициенты рабочих ячеек (в порядке CellsProp) по числу попаданий:
+// Kf - выравнивания x64, Gain - доля добавки по лямбде x64
+void kosh_gain_schedule(Kosh_t *Kosh, uint8_t Channel, uint8_t *Kf, uint8_t *Gain) {
+	uint8_t y[4] = {Kosh->y1, Kosh->y2, Kosh->y2, Kosh->y1};
+	uint8_t x[4] = {Kosh->x1, Kosh->x1, Kosh->x2, Kosh->x2};
+
+	for (uint8_t i = 0; i < 4; ++i) {
+		uint8_t Band = Kosh->Hits[Channel][y[i]][x[i]] >> KOSH_HIT_SHIFT;
+		Kf[i] = PGM_GET_BYTE(&kosh_gain_kf[Band]);
+		Gain[i] = PGM_GET_BYTE(&kosh_gain_add[Band]);
+	}
+}
+
+// Учет попаданий: шаг засчитывается ячейкам с заметным весом
+void kosh_hits_update(Kosh_t *Kosh, uint8_t Channel) {
+	uint8_t y[4] = {Kosh->y1, Kosh->y2, Kosh->y2, Kosh->y1};
+	uint8_t x[4] = {Kosh->x1, Kosh->x1, Kosh->x2, Kosh->x2};
+
+	for (uint8_t i = 0; i < 4; ++i) {
+		uint8_t *Hits = &Kosh->Hits[Channel][y[i]][x[i]];
+		if (Kosh->CellsProp[i] >= KOSH_HIT_WEIGHT && *Hits < 255) {(*Hits)++;}
+	}
+}
+
+// Сброс счетчиков попаданий канала вместе с его таблицей LTFT
+void kosh_hits_reset(Kosh_t *Kosh, uint8_t Channel) {
+	memset(Kosh->Hits[Channel], 0, sizeof(Kosh->Hits[Channel]));
+	#ifdef KOSH_SMOOTH
+		Kosh->HitsValid |= (1 << Channel);
+	#endif
+}
+
+// Счетчики попаданий обоих каналов загружены вместе с таблицами LTFT
+void kosh_hits_loaded(Kosh_t *Kosh) {
+	#ifdef KOSH_SMOOTH
+		Kosh->HitsValid = 3;
+	#else
+		(void) Kosh;
+	#endif
+}
+#endif
+
+#ifdef KOSH_SMOOTH
+// Сглаживание одной ячейки: если своих попаданий мало, значение
+// сдвигается к среднему четырех соседей, взвешенному по их попаданиям.
+void kosh_smooth_cell(Kosh_t *Kosh, uint8_t Channel, uint8_t y, uint8_t x) {
+	uint8_t (*Hits)[KOSH_GRID_RPM] = Kosh->Hits[Channel];
+	if (!(Kosh->HitsValid & (1 << Channel)) || Hits[y][x] >= KOSH_SMOOTH_HITS) {return;}
+
+	KoshRow_t *Table = kosh_ltft_table(Kosh, Channel, 0);
+	int16_t Sum = 0;
+	uint16_t W = 0;
+
+	// Вес соседа - попадания / 4, тогда сумма помещается в int16_t
+	if (y > 0)  {uint8_t w = Hits[y - 1][x] >> 2; Sum += w * Table[y - 1][x]; W += w;}
+	if (y < KOSH_GRID_LOAD - 1) {uint8_t w = Hits[y + 1][x] >> 2; Sum += w * Table[y + 1][x]; W += w;}
+	if (x > 0)  {uint8_t w = Hits[y][x - 1] >> 2; Sum += w * Table[y][x - 1]; W += w;}
+	if (x < KOSH_GRID_RPM - 1) {uint8_t w = Hits[y][x + 1] >> 2; Sum += w * Table[y][x + 1]; W += w;}
+
+	if (W < KOSH_SMOOTH_MIN_W) {return;}
+
+	// Вне пути обучения, обычное деление
+	int16_t Diff = Sum / (int16_t) W - Table[y][x];
+	if (!Diff) {return;}
+
+	int16_t Add = fix_sat16(fix_mul_shift(Diff, 1, KOSH_SMOOTH_SHIFT));
+	if (!Add) {Add = (Diff > 0) ? 1 : -1;}
+	kosh_write_value(Kosh, Table, y, x, Add, Channel);
+}
+
+// Порция фонового сглаживания: Budget ячеек по кругу, обе таблицы
+void kosh_smooth_step(Kosh_t *Kosh, uint8_t Budget) {
+	while (Budget--) {
+		kosh_smooth_cell(Kosh, Kosh->SmoothCh, Kosh->SmoothY, Kosh->SmoothX);
+
+		if (++Kosh->SmoothX < KOSH_GRID_RPM) {continue;}
+		Kosh->SmoothX = 0;
+		if (++Kosh->SmoothY < KOSH_GRID_LOAD) {continue;}
+		Kosh->SmoothY = 0;
+		Kosh->SmoothCh ^= 1;
+	}
+}
+#endif
+
+#ifdef KOSH_SHADOW
+// Ближайшая к точке рабочая ячейка (индекс в порядке CellsProp)
+static uint8_t kosh_stock_cell(Kosh_t *Kosh) {
+	uint8_t n = 0;
+	for (uint8_t i = 1; i < 4; ++i) {
+		if (Kosh->CellsProp[i] > Kosh->CellsProp[n]) {n = i;}
+	}
+	return n;
+}
+
+// Готов ли штатный алгоритм к шагу: с прошлого шага зонд канала
+// переключился не меньше KOSH_STOCK_SWT раз, и точка лежит достаточно
+// близко к узлу ближайшей ячейки. Без экземпляра лямбда коррекции
+// счетчика переключений нет, проверяется только положение точки.
+uint8_t kosh_stock_ready(Kosh_t *Kosh, uint8_t Channel) {
+	if (Kosh->ego && lambda_inst_get_swt_counter(Kosh->ego, Channel) < KOSH_STOCK_SWT) {return 0;}
+	return Kosh->CellsProp[kosh_stock_cell(Kosh)] >= KOSH_STOCK_BAND;
+}
+
+// Шаг штатного алгоритма, как в LTFT SECU-3: часть коррекции переносится
+// в одну ближайшую к точке ячейку, счетчик переключений зонда сбрасывается.
+// Вызывается, когда kosh_stock_ready() разрешил шаг.
+// return добавка, записанная в ячейку x512 (в единицах лямбда коррекции)
+int16_t kosh_stock_update(Kosh_t *Kosh, uint8_t Channel, int16_t Lambda) {
+	// Порядок ячеек как в CellsProp
+	uint8_t y[4] = {Kosh->y1, Kosh->y2, Kosh->y2, Kosh->y1};
+	uint8_t x[4] = {Kosh->x1, Kosh->x1, Kosh->x2, Kosh->x2};
+	uint8_t n = kosh_stock_cell(Kosh);
+
+	if (Kosh->ego) {lambda_inst_reset_swt_counter(Kosh->ego, Channel);}
+
+	int16_t Add = fix_sat16(fix_mul_shift(Lambda, KOSH_STOCK_GRAD, 8));
+	Add = kosh_write_value(Kosh, kosh_ltft_table(Kosh, Channel, 1), y[n], x[n], Add, Channel);
+	kosh_shadow_step(Kosh, KOSH_ALGO_STOCK, fix_abs16(Add));
+	return Add;
+}
+
+// Учет шага обучения алгоритма Algo в счетчиках сходимости.
+// MaxAdd - наибольшее изменение ячейки за шаг.
+void kosh_shadow_step(Kosh_t *Kosh, uint8_t Algo, int16_t MaxAdd) {
+	KoshShadowStat_t *Stat = &Kosh->Stat[Algo];
+
+	if (Stat->Steps < UINT16_MAX) {Stat->Steps++;}
+
+	if (MaxAdd > KOSH_SHADOW_STABLE_ADD) {
+		Stat->Stable = 0;
+		return;
+	}
+	if (Stat->Stable < UINT16_MAX) {Stat->Stable++;}
+	if (!Stat->Converged && Stat->Stable >= KOSH_SHADOW_STABLE_STEPS) {
+		Stat->Converged = Stat->Steps;
+	}
+}
+
+// Смена алгоритма, пишущего в таблицы ЭБУ. Таблицы меняются местами,
+// каждый алгоритм продолжает со своей таблицей. При поячеечном
+// сохранении таблицы ЭБУ целиком помечаются для записи.
+void kosh_shadow_select(Kosh_t *Kosh, uint8_t Stock) {
+	Stock = Stock ? 1 : 0;
+	if (Stock == Kosh->StockActive) {return;}
+
+	for (uint8_t c = 0; c < 2; ++c) {
+		KoshRow_t *Table = kosh_ltft_table(Kosh, c, Kosh->StockActive);
+		for (uint8_t y = 0; y < KOSH_GRID_LOAD; ++y) {
+			for (uint8_t x = 0; x < KOSH_GRID_RPM; ++x) {
+				int8_t Value = Table[y][x];
+				Table[y][x] = Kosh->Shadow[c][y][x];
+				Kosh->Shadow[c][y][x] = Value;
+			}
+		}
+		#ifdef KOSH_INCREMENTAL_SAVE
+			kosh_dirty_mark_all(Kosh, c);
+		#endif
+	}
+	Kosh->StockActive = Stock;
+}
+
+// Расхождение активной и теневой таблиц в ячейке x512
+int16_t kosh_shadow_divergence(Kosh_t *Kosh, uint8_t Channel, uint8_t y, uint8_t x) {
+	KoshRow_t *Table = kosh_ltft_table(Kosh, Channel, Kosh->StockActive);
+	return (int16_t) Table[y][x] - Kosh->Shadow[Channel][y][x];
+}
+#endif
+
+#ifdef KOSH_INCREMENTAL_SAVE
+// Выдача следующей измененной ячейки для сохранения в EEPROM.
+// Бит сбрасывается при выдаче, если ячейка изменится снова,
+// она будет выдана повторно.
+// return 0 - измененных ячеек нет
+uint8_t kosh_dirty_fetch(Kosh_t *Kosh, uint8_t Channel, uint8_t *y, uint8_t *x) {
+	for (uint8_t i = 0; i < KOSH_GRID_LOAD; i++) {
+		KoshDirty_t Row = Kosh->Dirty[Channel][i];
+		if (!Row) {continue;}
+
+		uint8_t j = 0;
+		while (!(Row & 1)) {
+			Row >>= 1;
+			j++;
+		}
+		Kosh->Dirty[Channel][i] &= ~((KoshDirty_t) 1 << j);
+		*y = i;
+		*x = j;
+		return 1;
+	}
+	return 0;
+}
+
+// Пометить всю таблицу канала как измененную (например, после сброса)
+void kosh_dirty_mark_all(Kosh_t *Kosh, uint8_t Channel) {
+	for (uint8_t i = 0; i < KOSH_GRID_LOAD; i++) {
+		Kosh->Dirty[Channel][i] = KOSH_DIRTY_ALL;
+	}
+}
+#endif
+
+// Построение сеток в ОЗУ. Сетка давления пересчитывается только при изменении
+// нижней/верхней границы давления или режима сетки, дальше все функции
+// берут точки сетки и обратные размеры ячеек из массивов в ОЗУ.
+void kosh_axis_update(Kosh_t *Kosh) {
+	struct ecudata_t* ecu = Kosh->ecu;
+
+	uint8_t UseGrid = CHECKBIT(ecu->param.func_flags, FUNC_LDAX_GRID) ? 1 : 2;
+	if (UseGrid == Kosh->UseGrid && ecu->param.load_lower == Kosh->LoadLower && ecu->param.load_upper == Kosh->LoadUpper) {return;}
+
+	// Сетка оборотов хранится во флеше и не меняется
+	if (!Kosh->UseGrid) {
+		for (uint8_t i = 0; i < KOSH_GRID_RPM; i++) {
+			Kosh->RPMAxis[i] = PGM_GET_WORD(&Kosh->fw->exdata.rpm_grid_points[i]);
+		}
+		Kosh->RPMShift = kosh_recip_update(Kosh->RPMAxis, Kosh->RPMRecip, KOSH_GRID_RPM);
+	}
+
+	Kosh->UseGrid = UseGrid;
+	Kosh->LoadLower = ecu->param.load_lower;
+	Kosh->LoadUpper = ecu->param.load_upper;
+
+	// Своя сетка давления из прошивки
+	if (UseGrid == 1) {
+		for (uint8_t i = 0; i < KOSH_GRID_LOAD; i++) {
+			Kosh->LoadAxis[i] = PGM_GET_WORD(&Kosh->fw->exdata.load_grid_points[i]);
+		}
+	}
+	// Равномерная сетка по двум значениям
+	else {
+		uint16_t StepMAP = (ecu->param.load_upper - ecu->param.load_lower) / (KOSH_GRID_LOAD - 1);
+		uint16_t Point = ecu->param.load_lower;
+		for (uint8_t i = 0; i < KOSH_GRID_LOAD; i++) {
+			Kosh->LoadAxis[i] = Point;
+			Point += StepMAP;
+		}
+	}
+
+	Kosh->LoadShift = kosh_recip_update(Kosh->LoadAxis, Kosh->LoadRecip, KOSH_GRID_LOAD);
+}
+
+// Обратные значения размеров ячеек x2048 << Shift для расчета веса точек.
+// Считаются один раз при построении сетки из Count точек. Сдвиг общий для
+// оси - наибольший (не больше 16), при котором обратное значение самой
+// короткой ячейки помещается в 16 бит. Возвращает сдвиг.
+// Доля x2048 = (dx * Recip) >> Shift, dx меньше размера ячейки, поэтому
+// произведение меньше 2048 << Shift и помещается в 32 бита. Ошибка доли
+// меньше Size >> Shift, а 2^Shift больше 16 размеров самой короткой ячейки,
+// поэтому для сетки, где ячейки различаются не больше чем в 16 раз, доля
+// отличается от точного деления меньше чем на 1.
+uint8_t kosh_recip_update(const uint16_t *Axis, uint16_t *Recip, uint8_t Count) {
+	uint16_t MinSize = UINT16_MAX;
+	for (uint8_t i = 0; i < Count - 1; i++) {
+		uint16_t Size = Axis[i + 1] - Axis[i];
+		if (Size && Size < MinSize) {MinSize = Size;}
+	}
+
+	uint8_t Shift = 16;
+	while (((uint32_t) 2048 << Shift) / MinSize > UINT16_MAX) {Shift--;}
+
+	for (uint8_t i = 0; i < Count - 1; i++) {
+		uint16_t Size = Axis[i + 1] - Axis[i];
+		Recip[i] = Size ? ((uint32_t) 2048 << Shift) / Size : 0;
+	}
+	return Shift;
+}
+
+// Деление Num * 2^Scale / Den без операции деления. Делитель нормализуется
+// к диапазону 2^15..2^16, тогда 1 / Den = Mant * 2^(k - 30), где k - сдвиг
+// нормализации, а Mant берется из таблицы обратных значений.
+// Результат округляется вниз, как при обычном делении, кроме редких
+// случаев, когда точное частное меньше целого на доли 1/4096.
+// Частное меньше 4096 от точного деления получается точным.
+uint16_t kosh_udiv(uint16_t Num, uint16_t Den, uint8_t Scale) {
+	if (!Den) {return 0;}
+
+	uint8_t Shift = 30 - Scale;
+	while (!(Den & 0x8000)) {
+		Den <<= 1;
+		Shift--;
+	}
+	// 6 старших битов после ведущей единицы - интервал таблицы,
+	// 9 младших - положение внутри него
+	uint8_t j = (Den >> 9) & 0x3F;
+	uint16_t Mant = PGM_GET_WORD(&kosh_recip_table[j]);
+	uint16_t Diff = Mant - PGM_GET_WORD(&kosh_recip_table[j + 1]);
+	Mant -= ((uint32_t) Diff * (Den & 0x1FF)) >> 9;
+	return fix_usat16(((uint32_t) Num * Mant) >> Shift);
+}
+
+// Деление со знаком Num * 2^Scale / Den через kosh_udiv(),
+// результат ограничивается диапазоном int16_t
+int16_t kosh_sdiv(int16_t Num, uint16_t Den, uint8_t Scale) {
+	uint16_t Q = kosh_udiv(fix_abs16(Num), Den, Scale);
+	return (Num < 0) ? fix_sat16(-(int32_t) Q) : fix_sat16(Q);
+}
+
+
+// Поиск ячейки сетки. Возвращает индекс i (1..Top), для которого
+// Axis[i - 1] < Value <= Axis[i], значение должно лежать внутри сетки,
+// Top - индекс последней точки сетки.
+// Точка обычно остается в той же или соседней ячейке, поэтому сначала
+// проверяется прошлая ячейка Last и ее соседи, потом двоичный поиск
+// по той части сетки, что осталась после этих проверок.
+uint8_t kosh_cell_locate(const uint16_t *Axis, uint8_t Top, uint16_t Value, uint8_t Last) {
+	uint8_t Lo = 1;
+	uint8_t Hi = Top;
+
+	if (Last >= 1 && Last <= Top) {
+		if (Value <= Axis[Last]) {
+			if (Value > Axis[Last - 1]) {return Last;}
+			if (Last >= 2) {
+				if (Value > Axis[Last - 2]) {return Last - 1;}
+				Hi = Last - 2;
+			}
+		}
+		else if (Last < Top) {
+			if (Value <= Axis[Last + 1]) {return Last + 1;}
+			if (Last + 2 <= Top) {Lo = Last + 2;}
+		}
+	}
+
+	while (Lo < Hi) {
+		uint8_t Mid = (Lo + Hi) >> 1;
+		if (Value <= Axis[Mid]) {Hi = Mid;}
+		else {Lo = Mid + 1;}
+	}
+	return Lo;
 }
 
 // Поиск задействованных ячеек в расчете	
-void kosh_find_cells(void) {
+void kosh_find_cells(Kosh_t *Kosh) {
 	// Чтобы убрать здесь и дальше исключительные ситуации,
 	// когда обороты меньше сетки или попали точно в сетку и т.п.,
 	// буду просто добавлять или отнимать единицу.
 
 	// Обороты
-	if (Kosh.RPM <= PGM_GET_WORD(&fw_data.exdata.rpm_grid_points[0])) {
-		Kosh.RPM = PGM_GET_WORD(&fw_data.exdata.rpm_grid_points[0]) + 1;
+	if (Kosh->RPM <= Kosh->RPMAxis[0]) {
+		Kosh->RPM = Kosh->RPMAxis[0] + 1;
 	}
-	if (Kosh.RPM >= PGM_GET_WORD(&fw_data.exdata.rpm_grid_points[15])) {
-		Kosh.RPM = PGM_GET_WORD(&fw_data.exdata.rpm_grid_points[15]) - 1;
+	if (Kosh->RPM >= Kosh->RPMAxis[KOSH_GRID_RPM - 1]) {
+		Kosh->RPM = Kosh->RPMAxis[KOSH_GRID_RPM - 1] - 1;
 	}
 
-	for (uint8_t i = 1; i < 16; i++) {
-		if (Kosh.RPM <= PGM_GET_WORD(&fw_data.exdata.rpm_grid_points[i])) {
-			if (Kosh.RPM == PGM_GET_WORD(&fw_data.exdata.rpm_grid_points[i])) {
-				Kosh.RPM -= 1;
-			}
-			Kosh.x1 = i - 1;
-			Kosh.x2 = i;
-			break;
-		}
+	Kosh->x2 = kosh_cell_locate(Kosh->RPMAxis, KOSH_GRID_RPM - 1, Kosh->RPM, Kosh->x2);
+	Kosh->x1 = Kosh->x2 - 1;
+	if (Kosh->RPM == Kosh->RPMAxis[Kosh->x2]) {
+		Kosh->RPM -= 1;
 	}
 
 	// Давление
-	if (Kosh.MAP <= (Kosh.UseGrid ? PGM_GET_WORD(&fw_data.exdata.load_grid_points[0]) : (d.param.load_lower))) {
-		Kosh.MAP = Kosh.UseGrid ? (PGM_GET_WORD(&fw_data.exdata.load_grid_points[0]) + 1) : (d.param.load_lower + 1);
+	if (Kosh->MAP <= Kosh->LoadAxis[0]) {
+		Kosh->MAP = Kosh->LoadAxis[0] + 1;
 	}
-	if (Kosh.MAP >= (Kosh.UseGrid ? PGM_GET_WORD(&fw_data.exdata.load_grid_points[15]) : (Kosh.StepMAP * 15 + d.param.load_lower))) {
-		Kosh.MAP = Kosh.UseGrid ? (PGM_GET_WORD(&fw_data.exdata.load_grid_points[15]) - 1) : (Kosh.StepMAP * 15 + d.param.load_lower - 1);
+	if (Kosh->MAP >= Kosh->LoadAxis[KOSH_GRID_LOAD - 1]) {
+		Kosh->MAP = Kosh->LoadAxis[KOSH_GRID_LOAD - 1] - 1;
 	}
 
-	for (uint8_t i = 1; i < 16; i++) {
-		if (Kosh.MAP <= (Kosh.UseGrid ? PGM_GET_WORD(&fw_data.exdata.load_grid_points[i]) : (Kosh.StepMAP * i + d.param.load_lower))) {
-			if (Kosh.MAP == (Kosh.UseGrid ? PGM_GET_WORD(&fw_data.exdata.load_grid_points[i]) : (Kosh.StepMAP * i + d.param.load_lower))) {
-				Kosh.MAP -= 1;
-			}
-			Kosh.y1 = i - 1;
-			Kosh.y2 = i;
-			break;
-		}
+	Kosh->y2 = kosh_cell_locate(Kosh->LoadAxis, KOSH_GRID_LOAD - 1, Kosh->MAP, Kosh->y2);
+	Kosh->y1 = Kosh->y2 - 1;
+	if (Kosh->MAP == Kosh->LoadAxis[Kosh->y2]) {
+		Kosh->MAP -= 1;
 	}
 }
 
 // Расчет веса точек в коррекции
-void kosh_points_weight(void) {
-	uint16_t x1 = PGM_GET_WORD(&fw_data.exdata.rpm_grid_points[Kosh.x1]);
-	uint16_t x2 = PGM_GET_WORD(&fw_data.exdata.rpm_grid_points[Kosh.x2]);
-	uint16_t y1 = Kosh.UseGrid ? PGM_GET_WORD(&fw_data.exdata.load_grid_points[Kosh.y1]) : (Kosh.StepMAP * Kosh.y1 + d.param.load_lower);
-	uint16_t y2 = Kosh.UseGrid ? PGM_GET_WORD(&fw_data.exdata.load_grid_points[Kosh.y2]) : (Kosh.StepMAP * Kosh.y2 + d.param.load_lower);
+void kosh_points_weight(Kosh_t *Kosh) {
+	uint16_t x2 = Kosh->RPMAxis[Kosh->x2];
+	uint16_t y2 = Kosh->LoadAxis[Kosh->y2];
 
-	uint16_t x = Kosh.RPM;
-	uint16_t y = Kosh.MAP;
+	uint16_t x = Kosh->RPM;
+	uint16_t y = Kosh->MAP;
 
 	uint16_t CFx1 = 0; // x2048 << 11
 	uint16_t CFx2 = 0; // x2048
 	uint16_t CFy1 = 0; // x2048
 	uint16_t CFy2 = 0; // x2048
 
-	CFx1 = (uint32_t) (x2 - x) * 2048 / (x2 - x1);
-	CFx2 = (uint32_t) (x - x1) * 2048 / (x2 - x1);
-				
-	CFy1 = (uint32_t) (y2 - y) * 2048 / (y2 - y1);
-	CFy2 = (uint32_t) (y - y1) * 2048 / (y2 - y1);
+	// Деление на размер ячейки заменено умножением на обратное значение x2048 << Shift
+	uint16_t RX = Kosh->RPMRecip[Kosh->x1];
+	uint16_t RY = Kosh->LoadRecip[Kosh->y1];
+
+	// Вторые доли дополняют первые до 2048, а вес последней ячейки
+	// дополняет остальные, тогда сумма весов ровно 2048 и интерполяция
+	// сводится к взвешенной сумме значений ячеек (kosh_cells_dot).
+	CFx1 = ((uint32_t) (x2 - x) * RX) >> Kosh->RPMShift;
+	CFx2 = 2048 - CFx1;
 
-	Kosh.CellsProp[0] = ((uint32_t) CFx1 * CFy1) >> 11;
-	Kosh.CellsProp[1] = ((uint32_t) CFx1 * CFy2) >> 11;
-	Kosh.CellsProp[2] = ((uint32_t) CFx2 * CFy2) >> 11;
-	Kosh.CellsProp[3] = ((uint32_t) CFx2 * CFy1) >> 11;
+	CFy1 = ((uint32_t) (y2 - y) * RY) >> Kosh->LoadShift;
+	CFy2 = 2048 - CFy1;
+
+	Kosh->CellsProp[0] = ((uint32_t) CFx1 * CFy1) >> 11;
+	Kosh->CellsProp[1] = ((uint32_t) CFx1 * CFy2) >> 11;
+	Kosh->CellsProp[3] = ((uint32_t) CFx2 * CFy1) >> 11;
+	Kosh->CellsProp[2] = 2048 - Kosh->CellsProp[0] - Kosh->CellsProp[1] - Kosh->CellsProp[3];
+}
+
+// Билинейная интерполяция значений четырех рабочих ячеек
+// по их весам Prop (x2048, в сумме 2048)
+uint16_t kosh_cells_dot(const uint16_t *Prop, const uint16_t *Value) {
+	uint32_t Sum = 0;
+	for (uint8_t i = 0; i < 4; ++i) {
+		Sum += (uint32_t) Value[i] * Prop[i];
+	}
+	return fix_usat16(Sum >> 11);
 }
 
-// Расчет добавки к VE
-void kosh_add_ve_calculate(uint8_t Channel) {
+// Расчет добавки к VE. CalcVE2 - интерполяция VE после выравнивания ячеек
+void kosh_add_ve_calculate(Kosh_t *Kosh, KoshStep_t *Step, int16_t Correction, uint16_t CalcVE2) {
 	// Значение ячейки VE * Коррекцию * Долю
 	uint16_t G[4] = {0, 0, 0, 0};
 	uint16_t SummDelta = 0;
 
-	// Если сдвигать биты с отрицательными числами, это может плохо закончиться.
-	// Потому d.corr.lambda[Channel] временно делаем положительным.
-	int8_t Ng = 1;
-	int8_t Lambda = d.corr.lambda[Channel];
-	if (Lambda < 0) {
-		Ng = -1;
-		Lambda *= Ng;
-	}
+	// Доли считаются от модуля коррекции, знак дает разница с целью
+	uint16_t Lambda = fix_abs16(Correction);
 
 	for (uint8_t i = 0; i < 4; ++i) {
-		G[i] = ((uint32_t) Kosh.LTFTVE[i] * Lambda) >> 9;
-		G[i] = ((uint32_t) G[i] * Kosh.CellsProp[i]) >> 11;
+		G[i] = fix_umul_shift(Step->LTFTVE[i], Lambda, 9);
+		G[i] = fix_umul_shift(G[i], Kosh->CellsProp[i], 11);
 		// Сумма отклонения
-		SummDelta += ((uint32_t) G[i] * Kosh.CellsProp[i]) >> 11;
+		SummDelta += fix_umul_shift(G[i], Kosh->CellsProp[i], 11);
 	}
 
-	uint16_t CalcVE2 = bilinear_interpolation(Kosh.RPM, Kosh.MAP,
-				Kosh.LTFTVE[0] + Kosh.VEAlignment[0],
-				Kosh.LTFTVE[1] + Kosh.VEAlignment[1],
-				Kosh.LTFTVE[2] + Kosh.VEAlignment[2],
-				Kosh.LTFTVE[3] + Kosh.VEAlignment[3],
-				PGM_GET_WORD(&fw_data.exdata.rpm_grid_points[Kosh.x1]),
-				Kosh.UseGrid ? PGM_GET_WORD(&fw_data.exdata.load_grid_points[Kosh.y1]) : (Kosh.StepMAP * Kosh.y1 + d.param.load_lower),
-				PGM_GET_WORD(&fw_data.exdata.rpm_grid_sizes[Kosh.x1]),
-				Kosh.UseGrid ? PGM_GET_WORD(&fw_data.exdata.load_grid_sizes[Kosh.y1]) : (Kosh.StepMAP),
-				1);
-
-	// Коэффициент отклонения от цели
-	uint16_t Cf = (Kosh.TargetVe - CalcVE2) * Ng;
-	Cf = (uint32_t) Cf * 1024 / SummDelta;
+	// Коэффициент отклонения от цели со знаком
+	int16_t Cf = fix_sat16((int32_t) Step->TargetVe - CalcVE2);
+	Cf = kosh_sdiv(Cf, SummDelta, 10);
 
 	// Добавка к VE
 	for (uint8_t i = 0; i < 4; ++i) {
-		Kosh.AddVE[i] = ((uint32_t) G[i] * Cf) >> 10;
-		Kosh.AddVE[i] *= Ng;
+		Step->AddVE[i] = fix_sat16(fix_mul_shift(Cf, G[i], 10));
 	}
 }
 
 // Вычисление оборотов и давления с учетом задержки
-void kosh_rpm_map_calc(void) {
-	// Берем последние 8 значений давления для вычисления среднего
-	uint32_t MAPAVG = 0;
-	for (uint8_t i = 0; i < 8; i++) {
-		int8_t Index = Kosh.BufferIndex - i;
-		if (Index < 0) {Index = KOSH_CBS + Index;}
-		MAPAVG += Kosh.BufferMAP[Index];
-	}
-
-  	MAPAVG = MAPAVG >> 3;
-  	if (MAPAVG > (Kosh.UseGrid ? PGM_GET_WORD(&fw_data.exdata.load_grid_points[15]) : (Kosh.StepMAP * 15 + d.param.load_lower))) {
-  		MAPAVG = Kosh.UseGrid ? PGM_GET_WORD(&fw_data.exdata.load_grid_points[15]) : (Kosh.StepMAP * 15 + d.param.load_lower);
-  	}
-  	// Находим задержку из сетки
-  	for (uint8_t i = 0; i < 16; i++) {
-  		if (MAPAVG <= (Kosh.UseGrid ? PGM_GET_WORD(&fw_data.exdata.load_grid_points[i]) : (Kosh.StepMAP * i + d.param.load_lower))) {
-
-  			// Значения лага хранятся в таблице "Такты ОПП (газ)"
-  			int8_t Index = (PGM_GET_BYTE(&fw_data.exdata.inj_aftstr_strk1[i])) >> 2;
-  			// Находим индекс оборотов и давления
-  			Index = Kosh.BufferIndex - Index;
-  			if (Index < 0) {Index = KOSH_CBS + Index;}
-
-  			// Вытаскиваем оборотов и давления из прошлого
-  			Kosh.RPM = Kosh.BufferRPM[Index];
-  			Kosh.MAP = Kosh.BufferMAP[Index];
-  			break;
-  		}
- 	}
+void kosh_rpm_map_calc(Kosh_t *Kosh) {
+	// Среднее давление последних KOSH_WIN значений из скользящей суммы
+	uint32_t MAPAVG;
+	uint16_t Seq;
+	do {
+		Seq = Kosh->BufferSeq;
+		kosh_barrier();
+		MAPAVG = Kosh->BufferWinMAP;
+		kosh_barrier();
+	} while ((Seq & 1) || Seq != Kosh->BufferSeq);
+
+	MAPAVG = (MAPAVG << KOSH_MAP_SHIFT) >> KOSH_WIN_SHIFT;
+	if (MAPAVG > Kosh->LoadAxis[KOSH_GRID_LOAD - 1]) {
+		MAPAVG = Kosh->LoadAxis[KOSH_GRID_LOAD - 1];
+	}
+	// Находим задержку из сетки
+	if (MAPAVG <= Kosh->LoadAxis[0]) {Kosh->LagCell = 0;}
+	else {Kosh->LagCell = kosh_cell_locate(Kosh->LoadAxis, KOSH_GRID_LOAD - 1, MAPAVG, Kosh->LagCell);}
+
+	// Значения лага в тактах хранятся в таблице "Такты ОПП (газ)".
+	// В ячейке буфера среднее за 4 такта, поэтому целая часть лага
+	// дает ячейку, а остаток - долю соседней, более старой ячейки.
+	// Таблица тактов всегда на 16 точек давления, при другой сетке
+	// ячейка пересчитывается в ее масштаб.
+	#if (KOSH_GRID_LOAD == 16)
+		uint8_t LagIndex = Kosh->LagCell;
+	#else
+		uint8_t LagIndex = ((uint16_t) Kosh->LagCell * 15 + (KOSH_GRID_LOAD - 1) / 2) / (KOSH_GRID_LOAD - 1);
+	#endif
+	uint8_t Lag = PGM_GET_BYTE(&Kosh->fw->exdata.inj_aftstr_strk1[LagIndex]);
+	uint8_t Slot = Lag >> 2;
+	uint8_t Frac = Lag & 3;
+	if (Slot > KOSH_CBS - 2) {
+		Slot = KOSH_CBS - 2;
+		Frac = 0;
+	}
+
+	// Вытаскиваем оборотов и давления из прошлого
+	uint16_t RPM[2];
+	uint16_t MAP[2];
+	kosh_buffer_read(Kosh, Slot, RPM, MAP);
+
+	Kosh->RPM = ((uint32_t) RPM[0] * (4 - Frac) + (uint32_t) RPM[1] * Frac) >> 2;
+	Kosh->MAP = ((uint32_t) MAP[0] * (4 - Frac) + (uint32_t) MAP[1] * Frac) >> 2;
+}
+
+// Чтение двух соседних ячеек буфера на расстоянии Slot от последней
+// заполненной: [0] - новее, [1] - старше. Копия берется между двумя
+// чтениями счетчика публикаций, если за это время буфер изменился
+// (запись из прерывания или другого потока), чтение повторяется.
+void kosh_buffer_read(Kosh_t *Kosh, uint8_t Slot, uint16_t *RPM, uint16_t *MAP) {
+	uint16_t Seq;
+	do {
+		Seq = Kosh->BufferSeq;
+		kosh_barrier();
+
+		// Последняя заполненная ячейка - перед текущей позицией буфера
+		uint8_t New = kosh_buffer_back(Kosh->BufferIndex, Slot + 1);
+		uint8_t Old = kosh_buffer_back(New, 1);
+		RPM[0] = kosh_sample_unpack(Kosh->BufferRPM[New], KOSH_RPM_SHIFT);
+		RPM[1] = kosh_sample_unpack(Kosh->BufferRPM[Old], KOSH_RPM_SHIFT);
+		MAP[0] = kosh_sample_unpack(Kosh->BufferMAP[New], KOSH_MAP_SHIFT);
+		MAP[1] = kosh_sample_unpack(Kosh->BufferMAP[Old], KOSH_MAP_SHIFT);
+
+		kosh_barrier();
+	} while ((Seq & 1) || Seq != Kosh->BufferSeq);
 }
 
 // Обновление буфера
-void kosh_circular_buffer_update(void) {
-	Kosh.BufferSumRPM += d.sens.inst_frq;
-	Kosh.BufferSumMAP += d.sens.inst_map;
-	Kosh.BufferAvg++;
+void kosh_circular_buffer_update(Kosh_t *Kosh) {
+	kosh_circular_buffer_push(Kosh, Kosh->ecu->sens.inst_frq, Kosh->ecu->sens.inst_map);
+}
+
+// Добавление такта в буфер. Значения передаются напрямую, без чтения d,
+// чтобы при прогоне логов можно было подавать их прямо из записи.
+void kosh_circular_buffer_push(Kosh_t *Kosh, uint16_t RPM, uint16_t MAP) {
+	Kosh->BufferSumRPM += RPM;
+	Kosh->BufferSumMAP += MAP;
+	Kosh->BufferAvg++;
 
 	// Достигнут предел усреднения
-	if (Kosh.BufferAvg >= 4) {
-		uint16_t RPM = Kosh.BufferSumRPM >> 2;
-		Kosh.BufferRPM[Kosh.BufferIndex] = RPM;
-		uint16_t MAP = Kosh.BufferSumMAP >> 2;
-		Kosh.BufferMAP[Kosh.BufferIndex] = MAP;
-
-		Kosh.BufferAvg = 0;
-		Kosh.BufferSumRPM = 0;
-		Kosh.BufferSumMAP = 0;
-
-		Kosh.BufferIndex++;
-		// Достигнут конец буфера
-		if (Kosh.BufferIndex >= KOSH_CBS) {
-			Kosh.BufferIndex = 0;
-		}
+	if (Kosh->BufferAvg >= 4) {
+		uint8_t Index = Kosh->BufferIndex;
+		KoshSample_t AvgMAP = kosh_sample_pack(Kosh->BufferSumMAP >> 2, KOSH_MAP_SHIFT);
+
+		// Нечетный счетчик - идет запись, читатель повторит чтение
+		Kosh->BufferSeq++;
+		kosh_barrier();
+
+		// Скользящая сумма: добавляем новое значение и убираем
+		// значение, вышедшее из окна последних KOSH_WIN ячеек.
+		Kosh->BufferWinMAP += AvgMAP;
+		Kosh->BufferWinMAP -= Kosh->BufferMAP[kosh_buffer_back(Index, KOSH_WIN)];
+
+		Kosh->BufferRPM[Index] = kosh_sample_pack(Kosh->BufferSumRPM >> 2, KOSH_RPM_SHIFT);
+		Kosh->BufferMAP[Index] = AvgMAP;
+
+		Kosh->BufferAvg = 0;
+		Kosh->BufferSumRPM = 0;
+		Kosh->BufferSumMAP = 0;
+
+		Index++;
+		if (Index >= KOSH_CBS) {Index = 0;}
+		Kosh->BufferIndex = Index;
+
+		// Публикация: ячейка, сумма и позиция записаны
+		kosh_barrier();
+		Kosh->BufferSeq++;
 	}
 }
 
@@ -423,54 +1022,233 @@ void kosh_circular_buffer_update(void) {
 // =============================================================================
 // =============================================================================
 
-void ltft_control(void) {
-	// Условия выхода из функции:
-	// 1 - Идет процесс записи в EEPROM
-	uint8_t ee_opcode = eeprom_get_pending_opcode();
-	if (ee_opcode == OPCODE_RESET_LTFT || ee_opcode == OPCODE_SAVE_LTFT) {return;}
-	// 2 - Температура ОЖ ниже порога
-	if (d.sens.temperat < ((int16_t)PGM_GET_WORD(&fw_data.exdata.ltft_learn_clt))) {return;}
-
-	#ifndef SECU3T
-		// 3 - Давление газа ниже порога
-		if (d.sens.map2 < PGM_GET_WORD(&fw_data.exdata.ltft_learn_gpa)) {return;}
-		// 4 - Дифференциальное давление газа ниже порога
-		if (PGM_GET_WORD(&fw_data.exdata.ltft_learn_gpd) && ((d.sens.map2 - d.sens.map) < PGM_GET_WORD(&fw_data.exdata.ltft_learn_gpd))) {return;}
+void ltft_inst_init(Kosh_t *Kosh, struct ecudata_t* ecu, const struct fw_data_t* fw, lambda_state_t* ego) {
+	memset(Kosh, 0, sizeof(Kosh_t));
+	Kosh->ecu = ecu;
+	Kosh->fw = fw;
+	Kosh->ego = ego;
+}
+
+// Событие обучения канала обработано
+static void kosh_learn_evt_done(Kosh_t *Kosh, uint8_t Channel) {
+	if (Kosh->ego) {lambda_inst_clear_learn_evt(Kosh->ego, 1 << Channel);}
+}
+
+// Число условий обучения
+#define KOSH_GATE_COUNT 7
+
+// Проверка условия обучения Gate (1..KOSH_GATE_COUNT)
+// return 0 - условие не выполнено, обучение не идет
+static uint8_t kosh_learn_gate(Kosh_t *Kosh, uint8_t Gate) {
+	struct ecudata_t* ecu = Kosh->ecu;
+
+	// Условия, при которых обучение не идет:
+	switch (Gate) {
+		// 1 - Идет процесс записи в EEPROM. При поячеечном сохранении
+		// (KOSH_INCREMENTAL_SAVE) обучение во время записи не останавливается:
+		// измененные после записи ячейки снова помечаются и уходят в EEPROM
+		// следующей порцией.
+		case 1: return !kosh_tables_locked();
+		// 2 - Температура ОЖ ниже порога
+		case 2: return ecu->sens.temperat >= ((int16_t)PGM_GET_WORD(&Kosh->fw->exdata.ltft_learn_clt));
+		#ifndef SECU3T
+			// 3 - Давление газа ниже порога
+			case 3: return ecu->sens.map2 >= PGM_GET_WORD(&Kosh->fw->exdata.ltft_learn_gpa);
+			// 4 - Дифференциальное давление газа ниже порога
+			case 4: return !PGM_GET_WORD(&Kosh->fw->exdata.ltft_learn_gpd) || ((ecu->sens.map2 - ecu->sens.map) >= PGM_GET_WORD(&Kosh->fw->exdata.ltft_learn_gpd));
+		#endif
+		// 5 - Адаптация выключена для текущего топлива
+		case 5: return ltft_inst_is_active(Kosh);
+		// 6 - Лямбда коррекция отключена
+		case 6: return ecu->sens.carb || CHECKBIT(ecu->param.inj_lambda_flags, LAMFLG_IDLCORR);
+		// 7 - Адаптация выключена на ХХ
+		case 7: return ecu->sens.carb || PGM_GET_BYTE(&Kosh->fw->exdata.ltft_on_idling);
+	}
+	return 1;
+}
+
+// Проверка условий обучения. Пока событие ждет, проход за проходом
+// проверяется только условие, не выполненное в прошлый раз: пока его
+// вход (температура, давление газа, топливо, режим, параметры) не
+// изменится, остальные условия ничего не решают. Вся цепочка
+// проверяется, только когда оно выполнено.
+// return 0 - обучение сейчас не идет
+static uint8_t kosh_learn_allowed(Kosh_t *Kosh) {
+	if (Kosh->GateFailed && !kosh_learn_gate(Kosh, Kosh->GateFailed)) {return 0;}
+
+	for (uint8_t Gate = 1; Gate <= KOSH_GATE_COUNT; ++Gate) {
+		if (Gate == Kosh->GateFailed) {continue;}
+		if (!kosh_learn_gate(Kosh, Gate)) {
+			Kosh->GateFailed = Gate;
+			return 0;
+		}
+	}
+	Kosh->GateFailed = 0;
+	return 1;
+}
+
+void ltft_inst_control(Kosh_t *Kosh) {
+	struct ecudata_t* ecu = Kosh->ecu;
+
+	// Проверки ниже выполняются только по событию от лямбда коррекции:
+	// коррекция одного из каналов достигла порога обучения. Без события
+	// обучать нечего, и проход основного цикла почти ничего не стоит.
+	// Событие ждет, пока коррекция не будет перенесена в таблицу или не
+	// упадет ниже порога, поэтому не теряется, если условия обучения
+	// сейчас не выполнены. Без экземпляра лямбда коррекции проверки
+	// выполняются каждый раз.
+	uint8_t evt = Kosh->ego ? lambda_inst_get_learn_evt(Kosh->ego) : 1;
+	#ifdef KOSH_DEFERRED
+		// Накопленную коррекцию нужно записать и без нового события
+		if (Kosh->Acc[0].Full || Kosh->Acc[1].Full) {evt = 1;}
+	#endif
+	if (!evt) {
+		#ifdef KOSH_SMOOTH
+			// Свободный проход - порция фонового сглаживания
+			if (!kosh_tables_locked() && ltft_inst_is_active(Kosh)) {
+				kosh_smooth_step(Kosh, KOSH_SMOOTH_BUDGET);
+			}
+		#endif
+		return;
+	}
+
+	if (!kosh_learn_allowed(Kosh)) {
+		#ifdef KOSH_DEFERRED
+			// Накопленные отсчеты получены в других условиях, их не пишем
+			memset(Kosh->Acc, 0, sizeof(Kosh->Acc));
+		#endif
+		return;
+	}
+
+	uint8_t chnum = (0x00 != ecu->param.lambda_selch) && !CHECKBIT(ecu->param.inj_lambda_flags, LAMFLG_MIXSEN) ? 2 : 1;
+	uint8_t chbeg = (0xFF == ecu->param.lambda_selch) && !CHECKBIT(ecu->param.inj_lambda_flags, LAMFLG_MIXSEN);
+
+	// Канал, который не обучается, не держит событие и накопитель
+	for (uint8_t i = 0; i < 2; ++i) {
+		if (i >= chbeg && i < chnum) {continue;}
+		kosh_learn_evt_done(Kosh, i);
+		#ifdef KOSH_DEFERRED
+			memset(&Kosh->Acc[i], 0, sizeof(KoshAcc_t));
+		#endif
+	}
+
+	#ifdef KOSH_DEFERRED
+		// Запись накопленной коррекции, по одному каналу за проход
+		for (uint8_t i = chbeg; i < chnum; ++i) {
+			if (Kosh->Acc[i].Full) {
+				kosh_acc_commit(Kosh, i);
+				return;
+			}
+		}
 	#endif
 
-	// 5 - Адаптация выключена для текущего топлива
-	if (!ltft_is_active()) {return;}
-	// 6 - Лямбда коррекция отключена
-	if (!d.sens.carb && !CHECKBIT(d.param.inj_lambda_flags, LAMFLG_IDLCORR)) {return;}
-	// 7 - Адаптация выключена на ХХ
-	if (!d.sens.carb && !PGM_GET_BYTE(&fw_data.exdata.ltft_on_idling)) {return;}
+	// Уходим, пока ни по одному каналу не накопится коррекция
+	uint8_t ready = 0;
+	for (uint8_t i = chbeg; i < chnum; ++i) {
+		if (kosh_lambda_ready(ecu->corr.lambda[i])) {
+			ready = 1;
+			continue;
+		}
+		// Коррекция ниже порога: событие канала погашено, а начатое
+		// накопление отправляется на запись, иначе оно ждало бы
+		// следующего события
+		kosh_learn_evt_done(Kosh, i);
+		#ifdef KOSH_DEFERRED
+			if (Kosh->Acc[i].Count) {Kosh->Acc[i].Full = 1;}
+		#endif
+	}
+	if (!ready) {return;}
 
-	uint8_t chnum = (0x00 != d.param.lambda_selch) && !CHECKBIT(d.param.inj_lambda_flags, LAMFLG_MIXSEN) ? 2 : 1;
-	uint8_t chbeg = (0xFF == d.param.lambda_selch) && !CHECKBIT(d.param.inj_lambda_flags, LAMFLG_MIXSEN);
+	#ifdef KOSH_DEFERRED
+		// Один отсчет на ячейку буфера тактов
+		if (Kosh->AccSeq == Kosh->BufferSeq) {return;}
+		Kosh->AccSeq = Kosh->BufferSeq;
+	#endif
 
+	// Переход к моей функции: общая для каналов часть считается один раз
+	if (!kosh_point_prepare(Kosh)) {return;}
 	for (uint8_t i = chbeg; i < chnum; ++i) {
-		// Переход к моей функции
-		kosh_ltft_control(i);
+		#ifdef KOSH_DEFERRED
+			kosh_acc_add(Kosh, i);
+		#else
+			kosh_channel_update(Kosh, i, ecu->corr.lambda[i]);
+			// Коррекция перенесена в таблицу
+			if (!kosh_lambda_ready(ecu->corr.lambda[i])) {kosh_learn_evt_done(Kosh, i);}
+		#endif
 	}
 }
 
-uint8_t ltft_is_active(void) {
-	if (PGM_GET_BYTE(&fw_data.exdata.ltft_mode)==0)	{
+uint8_t ltft_inst_is_active(Kosh_t *Kosh) {
+	if (PGM_GET_BYTE(&Kosh->fw->exdata.ltft_mode)==0)	{
 		return 0; //LTFT functionality turned off
 	}
-	else if (PGM_GET_BYTE(&fw_data.exdata.ltft_mode)==1) {
-		if (1==d.sens.gas)
+	else if (PGM_GET_BYTE(&Kosh->fw->exdata.ltft_mode)==1) {
+		if (1==Kosh->ecu->sens.gas)
 			return 0; // LTFT enabled only for petrol
 	}
-	else if (PGM_GET_BYTE(&fw_data.exdata.ltft_mode)==2) {
-		if (0==d.sens.gas)
+	else if (PGM_GET_BYTE(&Kosh->fw->exdata.ltft_mode)==2) {
+		if (0==Kosh->ecu->sens.gas)
 			return 0; // LTFT enabled only for gas
 	}
 	return 1;
 }
 
+void ltft_inst_stroke_event_notification(Kosh_t *Kosh) {
+	kosh_circular_buffer_update(Kosh);
+}
+
+void ltft_ve_cache_invalidate(void) {
+	kosh_ve_cache_invalidate(&KoshMain);
+}
+
+#ifdef KOSH_INCREMENTAL_SAVE
+uint8_t ltft_dirty_fetch(uint8_t Channel, uint8_t *y, uint8_t *x) {
+	return kosh_dirty_fetch(&KoshMain, Channel, y, x);
+}
+
+void ltft_dirty_mark_all(uint8_t Channel) {
+	kosh_dirty_mark_all(&KoshMain, Channel);
+}
+#endif
+
+#ifdef KOSH_ADAPTIVE
+uint8_t (*ltft_hits_table(uint8_t Channel))[KOSH_GRID_RPM] {
+	return KoshMain.Hits[Channel];
+}
+
+void ltft_hits_reset(uint8_t Channel) {
+	kosh_hits_reset(&KoshMain, Channel);
+}
+
+void ltft_hits_loaded(void) {
+	kosh_hits_loaded(&KoshMain);
+}
+#endif
+
+#ifdef KOSH_SHADOW
+void ltft_shadow_select(uint8_t Stock) {
+	kosh_shadow_select(&KoshMain, Stock);
+}
+
+int16_t ltft_shadow_divergence(uint8_t Channel, uint8_t y, uint8_t x) {
+	return kosh_shadow_divergence(&KoshMain, Channel, y, x);
+}
+
+const KoshShadowStat_t *ltft_shadow_stat(uint8_t Algo) {
+	return &KoshMain.Stat[Algo];
+}
+#endif
+
+void ltft_control(void) {
+	ltft_inst_control(&KoshMain);
+}
+
+uint8_t ltft_is_active(void) {
+	return ltft_inst_is_active(&KoshMain);
+}
+
 void ltft_stroke_event_notification(void) {
-	kosh_circular_buffer_update();
+	ltft_inst_stroke_event_notification(&KoshMain);
 }
 
 // FUEL_INJECT
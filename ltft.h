@@ -29,18 +29,309 @@
 
 	#ifdef FUEL_INJECT
 		#include <stdint.h>
+		#include "lambda.h"
+
+		struct ecudata_t;
+		struct fw_data_t;
+
+		// Размеры сетки LTFT (и VE): точки по оборотам и по давлению.
+		// Прошивка использует 16x16, при сборке на хосте можно задать другие,
+		// таблицы и сетки в данных ЭБУ должны быть того же размера.
+		#ifndef KOSH_GRID_RPM
+			#define KOSH_GRID_RPM 16
+		#endif
+		#ifndef KOSH_GRID_LOAD
+			#define KOSH_GRID_LOAD 16
+		#endif
+		#if (KOSH_GRID_RPM < 2) || (KOSH_GRID_RPM > 32) || (KOSH_GRID_LOAD < 2) || (KOSH_GRID_LOAD > 32)
+			#error "KOSH_GRID_RPM and KOSH_GRID_LOAD must be in range 2...32"
+		#endif
+
+		#ifdef KOSH_INCREMENTAL_SAVE
+			// Поячеечное сохранение таблиц LTFT: измененные ячейки помечаются,
+			// путь записи EEPROM забирает их через ltft_dirty_fetch() порциями,
+			// и обучение на время сохранения не останавливается. Флаг задается
+			// в сборке вместе с таким путем записи, без него таблицы пишутся
+			// целиком и обучение на время записи стоит.
+
+			// Строка битов измененных ячеек, бит на точку оборотов
+			#if (KOSH_GRID_RPM > 16)
+				typedef uint32_t KoshDirty_t;
+			#else
+				typedef uint16_t KoshDirty_t;
+			#endif
+			#define KOSH_DIRTY_ALL ((KoshDirty_t) ((KoshDirty_t) ~(KoshDirty_t) 0 >> (sizeof(KoshDirty_t) * 8 - KOSH_GRID_RPM)))
+		#endif
+
+		// Упакованная история тактов (KOSH_PACKED_HISTORY): обороты и давление
+		// хранятся байтом, шаг 32 об/мин и 1 кПа. В той же памяти буфер вдвое
+		// глубже и покрывает весь диапазон задержки (до 255 тактов, 64 ячейки),
+		// 32 ячейки без упаковки - задержку до 123 тактов.
+		#ifdef KOSH_PACKED_HISTORY
+			#define KOSH_RPM_SHIFT 5
+			#define KOSH_MAP_SHIFT 6
+			typedef uint8_t KoshSample_t;
+		#else
+			#define KOSH_RPM_SHIFT 0
+			#define KOSH_MAP_SHIFT 0
+			typedef uint16_t KoshSample_t;
+		#endif
+
+		// Размер буфера, от KOSH_WIN + 2 до 128 ячеек. Может быть задан при сборке.
+		// По умолчанию - степень двойки, переход через конец буфера делается
+		// по маске. Для другого размера - сравнением.
+		#ifndef KOSH_CBS
+			#ifdef KOSH_PACKED_HISTORY
+				#define KOSH_CBS 64
+			#else
+				#define KOSH_CBS 32
+			#endif
+		#endif
+		#if (KOSH_CBS < 10) || (KOSH_CBS > 128)
+			#error "KOSH_CBS must be in range 10...128"
+		#endif
+
+		// Сохраненные значения VE рабочих ячеек перечитываются не реже, чем
+		// через столько шагов обучения, чтобы правка таблиц VE на ходу
+		// подхватывалась и без вызова ltft_ve_cache_invalidate()
+		#ifndef KOSH_VE_CACHE_STEPS
+			#define KOSH_VE_CACHE_STEPS 16
+		#endif
+
+		// Окно усреднения давления для поиска задержки
+		#define KOSH_WIN_SHIFT 3
+		#define KOSH_WIN (1 << KOSH_WIN_SHIFT)
+
+		#ifdef KOSH_DEFERRED
+			// Число отсчетов (ячеек буфера тактов) в одной отложенной записи
+			#define KOSH_ACC_COUNT 16
+
+			// Накопитель отложенной записи канала
+			typedef struct {
+				int32_t SumPropLambda[4];	// Сумма долей ячеек, умноженных на лямбда коррекцию
+				uint16_t SumProp[4];		// Сумма долей ячеек x2048
+				uint8_t Count;				// Число отсчетов
+				uint8_t Full;				// Накопление закончено, ждет записи
+				uint8_t y1;					// Ячейки, в которых копятся отсчеты
+				uint8_t x1;					// -//-
+			} KoshAcc_t;
+		#endif
+
+		// Промежуточные значения шага обучения канала. Создаются на стеке
+		// kosh_channel_update() и не занимают память между вызовами.
+		typedef struct {
+			uint16_t LTFTVE[4];				// Значения VE с текущей коррекцией LTFT x2048
+			uint16_t CalcVE;				// Интерполяция начальной VE x2048
+			uint16_t TargetVe;				// Целевое VE x2048
+			int16_t VEAlignment[4];			// Добавка для выравнивания ячеек x2048
+			int16_t AddVE[4];				// Добавка к VE по коррекции x2048
+			int16_t LTFTAdd[4];				// Добавочный коэффициент LTFT x512
+		} KoshStep_t;
+
+		// Строка таблицы LTFT (x512), таблица адресуется как Table[y][x]
+		typedef int8_t KoshRow_t[KOSH_GRID_RPM];
+
+		#ifdef KOSH_SHADOW
+			// Теневой режим: штатный (по одной ближайшей ячейке) алгоритм и
+			// алгоритм двойной интерполяции обучаются на одних и тех же точках.
+			// Активный пишет в таблицы LTFT ЭБУ, второй - в теневые таблицы.
+			// Из лямбда коррекции снимается только записанное активным.
+			// Штатный делает шаг после KOSH_STOCK_SWT переключений зонда,
+			// пока он активен, второй учится только на его шагах.
+			// Теневые таблицы занимают 512 байт RAM.
+
+			// Число переключений уровня зонда (для ШДК - смен знака
+			// отклонения) от прошлого шага, после которого учится штатный
+			#define KOSH_STOCK_SWT 4
+
+			// Вес ближайшей ячейки x2048, начиная с которого учится штатный
+			// алгоритм (точка близко к узлу сетки)
+			#define KOSH_STOCK_BAND 1434
+			// Доля лямбда коррекции, переносимая в ячейку, x256
+			#define KOSH_STOCK_GRAD 128
+			// Шаг обучения считается спокойным, если ни одна ячейка
+			// не изменилась больше, чем на это значение (x512)
+			#define KOSH_SHADOW_STABLE_ADD 1
+			// Число спокойных шагов подряд, после которого таблица сошлась
+			#define KOSH_SHADOW_STABLE_STEPS 200
+
+			// Индексы алгоритмов в счетчиках
+			#define KOSH_ALGO_KOSH 0
+			#define KOSH_ALGO_STOCK 1
+
+			// Счетчики сходимости алгоритма
+			typedef struct {
+				uint16_t Steps;				// Число шагов обучения
+				uint16_t Stable;			// Спокойных шагов подряд
+				uint16_t Converged;			// Шаг, на котором таблица сошлась, 0 - еще нет
+			} KoshShadowStat_t;
+		#endif
+
+		#ifdef KOSH_ADAPTIVE
+			// Адаптивная скорость обучения: счетчики попаданий в ячейки задают
+			// коэффициент выравнивания (вместо постоянного Kf) и долю добавки
+			// по лямбде. Свежие ячейки учатся быстро, зрелые только подстраиваются.
+			// Счетчики занимают 512 байт RAM.
+
+			// Вес ячейки x2048, начиная с которого шаг засчитывается ей как попадание
+			#define KOSH_HIT_WEIGHT 512
+			// Число попаданий в одной ступени графика коэффициентов (2^5 = 32)
+			#define KOSH_HIT_SHIFT 5
+		#endif
+
+		#ifdef KOSH_SMOOTH
+			// Фоновое сглаживание таблиц LTFT: ячейки с малым числом попаданий
+			// подтягиваются к среднему соседей, взвешенному по их попаданиям.
+			// Работает в проходах основного цикла без событий обучения,
+			// не более KOSH_SMOOTH_BUDGET ячеек за проход, и только по таблице,
+			// счетчики которой восстановлены (ltft_hits_loaded()) или
+			// сброшены вместе с ней: после запуска они нулевые и ничего
+			// не говорят о зрелости ячеек обученной таблицы.
+			#ifndef KOSH_ADAPTIVE
+				#error "KOSH_SMOOTH requires KOSH_ADAPTIVE"
+			#endif
+			// Число ячеек, обрабатываемых за один проход основного цикла
+			#define KOSH_SMOOTH_BUDGET 4
+			// Ячейки, набравшие столько попаданий, не сглаживаются
+			#define KOSH_SMOOTH_HITS 8
+			// Наименьший суммарный вес соседей (попадания / 4)
+			#define KOSH_SMOOTH_MIN_W 2
+			// Шаг к среднему соседей: 1 / 2^KOSH_SMOOTH_SHIFT разницы, не меньше 1
+			#define KOSH_SMOOTH_SHIFT 2
+		#endif
+
+		// Чтение начального VE одной ячейки (y, x) x2048 для выбранного режима VE2
+		typedef uint16_t (*KoshVECell_t)(struct ecudata_t* ecu, uint8_t y, uint8_t x);
+
+		// Состояние алгоритма. Каждый экземпляр обучается независимо,
+		// прошивка использует один внутренний экземпляр.
+		typedef struct {
+			struct ecudata_t* ecu;			// Данные ЭБУ: входы, параметры и таблицы LTFT
+			const struct fw_data_t* fw;		// Калибровка во флэш: сетки, задержка, пределы и условия LTFT
+			lambda_state_t* ego;			// Лямбда коррекция, от которой приходят события обучения
+			uint8_t GateFailed;				// Условие обучения, не выполненное на прошлом проходе, 0 - нет
+			uint16_t RPM;					// Обороты x1
+			uint16_t MAP;					// Давление x64
+			uint8_t Kf;						// Коэффициент выравнивания x64
+			uint8_t x1;						// Координаты рабочих ячеек Обороты
+			uint8_t x2;						// -//-
+			uint8_t y1;						// Координаты рабочих ячеек Давление
+			uint8_t y2;						// -//-
+			uint8_t LagCell;				// Ячейка сетки давления для поиска задержки
+			uint16_t StartVE[4];			// Начальные значения VE x2048
+			uint8_t VECacheKey;				// Ключ значений StartVE: режим VE2 и набор таблиц, 0 - нет значений
+			uint8_t VECacheY;				// Ячейка, для которой получены значения StartVE
+			uint8_t VECacheX;				// -//-
+			uint8_t VECacheAge;				// Число использований StartVE без перечитывания
+			KoshVECell_t VECell;			// Чтение VE ячейки для режима VE2 из VECacheKey
+			uint16_t CellsProp[4];			// Вес ячеек в коррекции x2048
+			#ifdef KOSH_INCREMENTAL_SAVE
+				KoshDirty_t Dirty[2][KOSH_GRID_LOAD];	// Измененные ячейки LTFT по каналам, бит x в строке y
+			#endif
+			#ifdef KOSH_ADAPTIVE
+				uint8_t Hits[2][KOSH_GRID_LOAD][KOSH_GRID_RPM];	// Счетчики попаданий в ячейки по каналам, до 255
+			#endif
+			#ifdef KOSH_SMOOTH
+				uint8_t SmoothCh;			// Следующая ячейка фонового сглаживания: канал
+				uint8_t SmoothY;			// -//- строка
+				uint8_t SmoothX;			// -//- столбец
+				uint8_t HitsValid;			// Бит на канал: счетчики попаданий соответствуют таблице LTFT
+			#endif
+			#ifdef KOSH_SHADOW
+				uint8_t StockActive;		// 1 - в таблицы ЭБУ пишет штатный алгоритм, 0 - двойной интерполяции
+				int8_t Shadow[2][KOSH_GRID_LOAD][KOSH_GRID_RPM];	// Теневые таблицы LTFT по каналам x512
+				KoshShadowStat_t Stat[2];	// Счетчики сходимости по алгоритмам (KOSH_ALGO_xxx)
+			#endif
+			KoshSample_t BufferRPM[KOSH_CBS];	// Кольцевой буфер оборотов >> KOSH_RPM_SHIFT
+			KoshSample_t BufferMAP[KOSH_CBS];	// Кольцевой буфер давления >> KOSH_MAP_SHIFT
+			uint8_t BufferIndex;			// Текущая позиция буфера
+			// Счетчик публикаций буфера, нечетный во время записи. 16 бит:
+			// читатель, прерванный ровно на период счетчика, принял бы
+			// измененный буфер за прежний. Байт проходит период за 128
+			// ячеек (512 тактов, около 2 с при 8000 об/мин), 16 бит - за
+			// 32768 ячеек, несколько минут работы. На AVR счетчик читается
+			// побайтно, младшим байтом вперед: если запись попала между
+			// байтами, значение нечетное или не совпадает, чтение повторяется.
+			volatile uint16_t BufferSeq;
+			uint8_t BufferAvg;				// Текущая позиция усреднения
+			uint32_t BufferSumRPM;			// Переменная для суммирования оборотов
+			uint32_t BufferSumMAP;			// Переменная для суммирования давления
+			uint32_t BufferWinMAP;			// Сумма давления последних KOSH_WIN ячеек буфера >> KOSH_MAP_SHIFT
+			#ifdef KOSH_DEFERRED
+				KoshAcc_t Acc[2];			// Накопители отложенной записи по каналам
+				uint16_t AccSeq;			// Счетчик публикаций буфера при последнем отсчете
+			#endif
+			uint8_t UseGrid;				// Режим сетки давления: 0 - не построена, 1 - своя сетка, 2 - по двум значениям
+			uint16_t LoadLower;				// Нижняя граница давления, по которой построена сетка
+			uint16_t LoadUpper;				// Верхняя граница давления, по которой построена сетка
+			uint16_t RPMAxis[KOSH_GRID_RPM];		// Точки сетки оборотов
+			uint16_t LoadAxis[KOSH_GRID_LOAD];		// Точки сетки давления x64
+			uint16_t RPMRecip[KOSH_GRID_RPM - 1];	// Обратные размеры ячеек сетки оборотов x2048 << RPMShift
+			uint16_t LoadRecip[KOSH_GRID_LOAD - 1];	// Обратные размеры ячеек сетки давления x2048 << LoadShift
+			uint8_t RPMShift;				// Масштаб RPMRecip, см. kosh_recip_update()
+			uint8_t LoadShift;				// Масштаб LoadRecip
+		} Kosh_t;
+
 		//	Control of LTFT "learning" 
 		//	uses d ECU data structure
 		void ltft_control(void);
 
+		// Instance API. Each instance uses its own state, the ECU data
+		// structure and the calibration (fw) it was initialized with, so any
+		// number of them can run independently. Functions above work with
+		// the firmware's instance (d, fw_data).
+		void ltft_inst_init(Kosh_t *Kosh, struct ecudata_t* ecu, const struct fw_data_t* fw, lambda_state_t* ego);
+		void ltft_inst_control(Kosh_t *Kosh);
+		uint8_t ltft_inst_is_active(Kosh_t *Kosh);
+		void ltft_inst_stroke_event_notification(Kosh_t *Kosh);
+
 		// ====================================================
-		void kosh_ltft_control(uint8_t Channel);
-		void kosh_write_value(uint8_t y, uint8_t x, uint8_t n, uint8_t Channel);
-		void kosh_find_cells(void);
-		void kosh_points_weight(void);
-		void kosh_add_ve_calculate(uint8_t Channel);
-		void kosh_rpm_map_calc(void);
-		void kosh_circular_buffer_update(void);
+		void kosh_ltft_control(Kosh_t *Kosh, uint8_t Channel);
+		uint8_t kosh_point_prepare(Kosh_t *Kosh);
+		void kosh_channel_update(Kosh_t *Kosh, uint8_t Channel, int16_t Lambda);
+		#ifdef KOSH_DEFERRED
+			void kosh_acc_add(Kosh_t *Kosh, uint8_t Channel);
+			void kosh_acc_commit(Kosh_t *Kosh, uint8_t Channel);
+		#endif
+		KoshVECell_t kosh_ve_cell_select(uint8_t Mode);
+		uint8_t kosh_ve_fetch(Kosh_t *Kosh);
+		void kosh_ve_cache_invalidate(Kosh_t *Kosh);
+		KoshRow_t *kosh_ltft_table(Kosh_t *Kosh, uint8_t Channel, uint8_t Stock);
+		int16_t kosh_write_value(Kosh_t *Kosh, KoshRow_t *Table, uint8_t y, uint8_t x, int16_t Add, uint8_t Channel);
+		#ifdef KOSH_ADAPTIVE
+			void kosh_gain_schedule(Kosh_t *Kosh, uint8_t Channel, uint8_t *Kf, uint8_t *Gain);
+			void kosh_hits_update(Kosh_t *Kosh, uint8_t Channel);
+			void kosh_hits_reset(Kosh_t *Kosh, uint8_t Channel);
+			void kosh_hits_loaded(Kosh_t *Kosh);
+		#endif
+		#ifdef KOSH_SMOOTH
+			void kosh_smooth_cell(Kosh_t *Kosh, uint8_t Channel, uint8_t y, uint8_t x);
+			void kosh_smooth_step(Kosh_t *Kosh, uint8_t Budget);
+		#endif
+		#ifdef KOSH_SHADOW
+			uint8_t kosh_stock_ready(Kosh_t *Kosh, uint8_t Channel);
+			int16_t kosh_stock_update(Kosh_t *Kosh, uint8_t Channel, int16_t Lambda);
+			void kosh_shadow_step(Kosh_t *Kosh, uint8_t Algo, int16_t MaxAdd);
+			void kosh_shadow_select(Kosh_t *Kosh, uint8_t Stock);
+			int16_t kosh_shadow_divergence(Kosh_t *Kosh, uint8_t Channel, uint8_t y, uint8_t x);
+		#endif
+		void kosh_axis_update(Kosh_t *Kosh);
+		uint8_t kosh_recip_update(const uint16_t *Axis, uint16_t *Recip, uint8_t Count);
+		uint16_t kosh_udiv(uint16_t Num, uint16_t Den, uint8_t Scale);
+		int16_t kosh_sdiv(int16_t Num, uint16_t Den, uint8_t Scale);
+		uint8_t kosh_cell_locate(const uint16_t *Axis, uint8_t Top, uint16_t Value, uint8_t Last);
+		#ifdef KOSH_INCREMENTAL_SAVE
+			uint8_t kosh_dirty_fetch(Kosh_t *Kosh, uint8_t Channel, uint8_t *y, uint8_t *x);
+			void kosh_dirty_mark_all(Kosh_t *Kosh, uint8_t Channel);
+		#endif
+		void kosh_find_cells(Kosh_t *Kosh);
+		void kosh_points_weight(Kosh_t *Kosh);
+		uint16_t kosh_cells_dot(const uint16_t *Prop, const uint16_t *Value);
+		void kosh_add_ve_calculate(Kosh_t *Kosh, KoshStep_t *Step, int16_t Correction, uint16_t CalcVE2);
+		void kosh_rpm_map_calc(Kosh_t *Kosh);
+		void kosh_buffer_read(Kosh_t *Kosh, uint8_t Slot, uint16_t *RPM, uint16_t *MAP);
+		void kosh_circular_buffer_update(Kosh_t *Kosh);
+		void kosh_circular_buffer_push(Kosh_t *Kosh, uint16_t RPM, uint16_t MAP);
 		// ====================================================
 
 		// Get LTFT status
@@ -49,5 +340,47 @@
 
 		// Must be called from the main loop to notify about stroke events
 		void ltft_stroke_event_notification(void);
+
+		// Should be called when VE tables are edited or reloaded, otherwise
+		// LTFT picks up the new VE values at most KOSH_VE_CACHE_STEPS steps later
+		void ltft_ve_cache_invalidate(void);
+
+		#ifdef KOSH_INCREMENTAL_SAVE
+			// Incremental saving of LTFT tables. The EEPROM save path takes
+			// changed cells one by one, a few per main loop pass, and writes
+			// only them. A cell changed again after it was fetched is fetched again.
+			// return 0 - no changed cells left in the table of Channel
+			uint8_t ltft_dirty_fetch(uint8_t Channel, uint8_t *y, uint8_t *x);
+
+			// Mark the whole table of Channel as changed (after reset or load)
+			void ltft_dirty_mark_all(uint8_t Channel);
+		#endif
+
+		#ifdef KOSH_ADAPTIVE
+			// Per-cell hit counters of Channel, Table[y][x]. The EEPROM path
+			// saves and loads them alongside the LTFT table of the same channel.
+			uint8_t (*ltft_hits_table(uint8_t Channel))[KOSH_GRID_RPM];
+
+			// Clear hit counters of Channel (together with reset of its LTFT table)
+			void ltft_hits_reset(uint8_t Channel);
+
+			// Must be called by the EEPROM path when hit counters of both channels
+			// have been loaded. Until then (or ltft_hits_reset()) the counters
+			// do not match the LTFT tables and background smoothing is not run.
+			void ltft_hits_loaded(void);
+		#endif
+
+		#ifdef KOSH_SHADOW
+			// Select the algorithm writing into the LTFT tables: 1 - stock,
+			// 0 - double interpolation. The other one continues in the shadow
+			// tables, tables are swapped so each algorithm keeps its own.
+			void ltft_shadow_select(uint8_t Stock);
+
+			// Difference between the active and the shadow table in a cell (x512)
+			int16_t ltft_shadow_divergence(uint8_t Channel, uint8_t y, uint8_t x);
+
+			// Convergence counters of an algorithm (KOSH_ALGO_xxx)
+			const KoshShadowStat_t *ltft_shadow_stat(uint8_t Algo);
+		#endif
 	#endif
 #endif //_LTFT_H_